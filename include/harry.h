@@ -47,29 +47,6 @@ typedef struct _vcache_t vcache_t;
 #endif
 
 //  TODO: remove these structs by placing them inside each class
-/*
- * Symbols for tokens. Note: Some measures enumerate all possible symbols.
- * These need to be patched first to support larger symbol sizes.
- */
-typedef uint64_t sym_t;
-/**
- * Structure for a string
- */
-struct _hstring_t
-{
-    union
-    {
-        char *c;              /**< Byte or bit representation */
-        sym_t *s;             /**< Word representation */
-    } str;
-
-    int len;                  /**< Length of string */
-    unsigned int type;        /**< Type of string */
-
-    char *src;                /**< Optional source of string */
-    float label;              /**< Optional label of string */
-};
-
 /**
  * Structure for measure interface
  */
@@ -78,8 +55,45 @@ typedef struct
     char *name;     // Name of measure
     measures_config_fn *measure_config;      // Init function
     measures_compare_fn *measure_compare;    // Comparison function
+    int cost;       // Complexity of comparison (for scheduling)
 } measures_func_t;
 
+//  Complexity of measures in the length of the strings
+#define MEASURES_LINEAR         0
+#define MEASURES_QUADRATIC      1
+
+//  Stages of the prefilter cascade for edit distances
+#define PREFILTER_LENGTH        0   // Pruned by length difference
+#define PREFILTER_BAG           1   // Pruned by bag signatures
+#define PREFILTER_FULL          2   // Computed by the measure
+#define PREFILTER_STAGES        8   // Counters per thread (cache line)
+
+//  Initial bound of banded edit distances in cheapest operations
+#define MEASURES_BAND           32
+
+/*
+ * Band of diagonals t = j - i for edit distances bounded by k. A cell on
+ * diagonal t is reached by at least |t| and left by at least |ly - lx - t|
+ * insertions or deletions, each costing at least c. Only diagonals with
+ * c * (|t| + |ly - lx - t|) <= k lie on paths within the bound. Returns
+ * false if there is no such diagonal.
+ */
+static inline int
+measures_band (int lx, int ly, double k, double c, int *lo, int *hi)
+{
+    int d = ly - lx;
+    double w = c > 0 ? floor ((k / c - abs (d)) / 2) : INFINITY;
+
+    if (w < 0)
+        return 0;
+
+    /* Wider bands cover the full matrix */
+    w = fmin (w, lx < ly ? lx : ly);
+    *lo = (d < 0 ? d : 0) - (int) w;
+    *hi = (d > 0 ? d : 0) + (int) w;
+    return 1;
+}
+
 typedef struct
 {
     //  Normalizations
@@ -99,9 +113,15 @@ typedef struct
     cfg_int max_sym;
     //  Coefficients
     int binary;
+    cfg_int sketch;         /**< Number of bins of sketches (0 for exact) */
     //  Kernel wdegree
     cfg_int degree;         /**< Degree of kernel */
     cfg_int shift;          /**< Shift of kernel */
+    //  Kernel spectrum/subsequence
+    cfg_int length;         /**< Length of k-mers or subsequences */
+    double lambda;          /**< Weight of gaps in subsequences */
+    //  Cutoff for early termination
+    double max_dist;        /**< Bound on distance (INFINITY for none) */
 } measures_opts_t;
 
 struct _measures_t {
@@ -110,8 +130,34 @@ struct _measures_t {
     measures_opts_t *opts;
     cfg_int global_cache;
     vcache_t *cache;
+    double prefilter;       // Cutoff of prefilter cascade (INFINITY if off)
+    double prefilter_cost;  // Minimum cost of an edit operation
+    uint64_t (*prefilter_stats)[PREFILTER_STAGES];
+    void **local;           // Per-thread state of the measure
+    void (*local_free)(void *);  // Destructor of per-thread state
+    struct _scratch_t *scratch;  // Per-thread scratch memory
     int idx;
     int verbose;
     int log_line;
 };
+
+/*
+ * Returns the slot for per-thread state of a measure or NULL if the
+ * calling thread has no slot. Slots belong to threads, not to OpenMP
+ * teams, so measures may be compared from any thread. Measures set
+ * local_free when filling it.
+ */
+void **measures_local (measures_t *self);
+
+/*
+ * Scratch memory of measures. Each thread allocates from its own block
+ * in stack order and releasing an allocation also releases all later
+ * ones. Allocations that do not fit go to the heap until everything is
+ * released and the block grows, such that comparisons do not touch the
+ * heap once the block is large enough.
+ */
+void *measures_alloc (measures_t *self, size_t size);
+void measures_release (measures_t *self, void *ptr);
+void measures_heap_inc (measures_t *self);
+uint64_t measures_heap (measures_t *self);
 #endif
@@ -142,6 +142,100 @@ HARRY_EXPORT void
 #endif // HARRY_BUILD_DRAFT_API
 //  @end
 
+#ifdef HARRY_BUILD_DRAFT_API
+#include "util.h"
+
+/*
+ * Symbols for tokens. Note: Some measures enumerate all possible symbols.
+ * These need to be patched first to support larger symbol sizes.
+ */
+typedef uint64_t sym_t;
+
+/** Number of buckets of the bag signature of a string */
+#define HSTRING_BAG 32
+
+/**
+ * Structure for a string
+ */
+struct _hstring_t
+{
+    union
+    {
+        char *c;              /**< Byte or bit representation */
+        sym_t *s;             /**< Word representation */
+    } str;
+
+    int len;                  /**< Length of string */
+    unsigned int type;        /**< Type of string */
+
+    char *src;                /**< Optional source of string */
+    float label;              /**< Optional label of string */
+
+    uint64_t hash;            /**< Cached hash of string (0 if unset) */
+    uint8_t bag[HSTRING_BAG]; /**< Saturated counts of hashed symbols */
+    int bag_len;              /**< Length covered by bag signature */
+    void *spec;               /**< Cached k-mer spectrum (NULL if unset) */
+    void *hist;               /**< Cached histogram of tokens (NULL if unset) */
+    void *sketch;             /**< MinHash sketch of symbols (NULL if unset) */
+};
+
+/*
+ * Type-specialized access to symbols. Measures call these functions with
+ * a constant string type, such that the compiler generates one inner loop
+ * per type instead of dispatching on the type for every symbol. Unlike
+ * hstring_get(), which sign-extends bytes, hstring_sym() returns bytes
+ * as unsigned values 0-255. Both agree on equality of symbols.
+ */
+#if defined (__GNUC__)
+#define HSTRING_INLINE static inline __attribute__ ((always_inline))
+#else
+#define HSTRING_INLINE static inline
+#endif
+
+HSTRING_INLINE sym_t
+hstring_sym (const hstring_t *self, int i, const unsigned int type)
+{
+    switch (type) {
+    case HSTRING_TYPE_TOKEN:
+        return self->str.s[i];
+    case HSTRING_TYPE_BYTE:
+        return (unsigned char) self->str.c[i];
+    default:
+        return (self->str.c[i >> 3] >> (7 - (i & 7))) & 1;
+    }
+}
+
+HSTRING_INLINE int
+hstring_equal (const hstring_t *x, int i, const hstring_t *y, int j,
+               const unsigned int type)
+{
+    return hstring_sym (x, i, type) == hstring_sym (y, j, type);
+}
+
+/*
+ * Calls a function specialized for the type of a string. The type is
+ * passed as last argument and the result is stored in r. Unknown types
+ * are reported with error() from util.h.
+ */
+#define HSTRING_SPECIALIZE(r, t, f, ...) \
+    do { \
+        switch (t) { \
+        case HSTRING_TYPE_BYTE: \
+            r = f (__VA_ARGS__, HSTRING_TYPE_BYTE); \
+            break; \
+        case HSTRING_TYPE_TOKEN: \
+            r = f (__VA_ARGS__, HSTRING_TYPE_TOKEN); \
+            break; \
+        case HSTRING_TYPE_BIT: \
+            r = f (__VA_ARGS__, HSTRING_TYPE_BIT); \
+            break; \
+        default: \
+            error ("Unknown string type"); \
+            r = 0; \
+        } \
+    } while (0)
+#endif // HARRY_BUILD_DRAFT_API
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,6 +5,31 @@ Options:
 - measures.global_cache = false;
     Enables global cache
 
+- measures.max_distance = -1.0;
+    Distances stop early once they exceed this bound and return a value
+    larger than the bound instead.  Values within the bound are exact.
+    Negative values disable the bound.
+
+- measures.prefilter = -1.0;
+    Pairs are pruned by their length difference and bag signatures before
+    computing the Levenshtein, OSA or Damerau-Levenshtein distance, if
+    these lower bounds exceed this cutoff.  Pruned pairs yield the lower
+    bound.  Negative values disable the prefilter.
+
+- measures.lsh = "";
+    Only candidate pairs of locality-sensitive hashing are compared, if
+    set to "bands:rows".  The MinHash sketch of each string is split
+    into bands of rows bins and strings sharing a band are compared.
+    All other pairs are missing from the sparse rows of the matrix.
+    Within buckets of more than 128 strings, for example identical
+    templates, each string is paired with 128 strings in each band.
+    The order of strings differs between bands, such that more bands
+    pair a larger share of the bucket.
+
+- measures.lsh_qgram = 0;
+    Length of q-grams hashed into the sketches of LSH.  By default,
+    edit distances use 3-grams and all other measures single symbols.
+
 - measures.granularity = "bytes";
     This parameter controls the granularity of strings. It can be set to
     either bits, bytes or tokens. Depending in the granularity a string is
@@ -39,6 +39,19 @@ int strip_newline(char *s, int l);
 void debug_msg(char *m, ...);
 void log_print(vcache_t *cache, long, long, long);
 float hround(float, int);
+int simd_level();
+
+/* Vector instructions available to kernels, ordered by width */
+#define SIMD_NONE       0
+#define SIMD_NEON       1
+#define SIMD_SSE42      1
+#define SIMD_AVX2       2
+
+#if defined (__GNUC__) && (defined (__x86_64__) || defined (__i386__))
+#define SIMD_X86        1
+#elif defined (__ARM_NEON) && defined (__aarch64__)
+#define SIMD_ARM        1
+#endif
 
 #if !defined (MIN)
 #define MIN(a, b) (a < b ? a : b)
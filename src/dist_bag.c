@@ -22,14 +22,6 @@
  *
  */
 
-/* Hash table */
-typedef struct
-{
-    sym_t sym;          /**< Symbol or character */
-    float cnt;          /**< Count of symbol */
-    UT_hash_handle hh;  /**< uthash handle */
-} bag_t;
-
 /**
  * Initializes the similarity measure
  */
@@ -45,47 +37,6 @@ dist_bag_config (measures_t *self)
     opts->lnorm = lnorm_get (str);
 }
 
-/**
- * Computes a histogram of symbols or characters
- * @param x string
- * @return histogram
- */
-static bag_t *
-bag_new (hstring_t *x)
-{
-    bag_t *xh = NULL, *bag = NULL;
-
-    for (int i = 0; i < x->len; i++) {
-        sym_t s = hstring_get(x, i);
-        HASH_FIND(hh, xh, &s, sizeof(sym_t), bag);
-
-        if (!bag) {
-            bag = (bag_t *) zmalloc(sizeof(bag_t));
-            bag->sym = s;
-            bag->cnt = 0;
-            HASH_ADD(hh, xh, sym, sizeof(sym_t), bag);
-        }
-
-        bag->cnt++;
-    }
-
-    return xh;
-}
-
-/**
- * Free the memory of histogram
- * @param xh Histogram
- */
-static void bag_destroy(bag_t * xh)
-{
-    /* Clear hash table */
-    while (xh) {
-        bag_t *bag = xh;
-        HASH_DEL(xh, bag);
-        free(bag);
-    }
-}
-
 /**
  * Computes the bag distance of two strings. The distance approximates
  * and lower bounds the Levenshtein distance.
@@ -97,29 +48,16 @@ float
 dist_bag_compare (measures_t *self, hstring_t *x, hstring_t *y)
 {
     assert (self);
-    float xd = 0, yd = 0;
-    bag_t *xh, *yh, *xb, *yb;
     measures_opts_t *opts = self->opts;
 
-    xh = bag_new (x);
-    yh = bag_new (y);
-
-    int missing = y->len;
-    for (xb = xh; xb != NULL; xb = (bag_t *) xb->hh.next) {
-        HASH_FIND(hh, yh, &(xb->sym), sizeof(sym_t), yb);
-        if (!yb) {
-            xd += xb->cnt;
-        } else {
-            float diff = xb->cnt - yb->cnt;
-            xd += fmax(+diff, 0);
-            yd += fmax(-diff, 0);
-            missing -= yb->cnt;
-        }
-    }
-    yd += missing;
+    //  The length difference lower bounds the distance
+    float lb = fabs (y->len - x->len);
+    if (opts->lnorm == LN_NONE && lb > opts->max_dist)
+        return lb;
 
-    bag_destroy (xh);
-    bag_destroy (yh);
+    //  Symbols not matched in either string
+    overlap_t o = hist_overlap (self, x, y);
+    float xd = x->len - o.inter, yd = y->len - o.inter;
 
     if (opts->lnorm == LN_NONE)
         return fmax (xd, yd);
@@ -34,30 +34,144 @@ dist_compression_config (measures_t *self)
 }
 
 
+/* Size of the buffer receiving (and discarding) compressed data */
+#define COMPRESS_CHUNK      16384
+
 /**
- * Compress one string and return the length of the compressed data
- * @param x String x
+ * Per-thread state of the compression. The stream is reset instead of
+ * being set up for every string.
+ */
+typedef struct
+{
+    z_stream strm;                      /**< Stream for compression */
+    unsigned char out[COMPRESS_CHUNK];  /**< Discarded output */
+} zstate_t;
+
+/**
+ * Frees the state of the compression
+ * @param ptr state
+ */
+static void
+zstate_free (void *ptr)
+{
+    zstate_t *z = (zstate_t *) ptr;
+
+    deflateEnd(&z->strm);
+    free(z);
+}
+
+/**
+ * Returns the state of the compression for the calling thread. The
+ * state is created on first use.
+ * @param self measure
+ * @param tmp set to true if the state needs to be freed by the caller
+ * @return state or NULL on error
+ */
+static zstate_t *
+zstate_get (measures_t *self, int *tmp)
+{
+    void **slot = measures_local(self);
+    zstate_t *z;
+
+    *tmp = slot == NULL;
+    if (slot && *slot)
+        return (zstate_t *) *slot;
+
+    z = (zstate_t *) zmalloc(sizeof(zstate_t));
+    if (!z || deflateInit(&z->strm, self->opts->level) != Z_OK) {
+        error("Failed to initialize compression");
+        free(z);
+        return NULL;
+    }
+    measures_heap_inc(self);
+
+    if (slot) {
+        self->local_free = zstate_free;
+        *slot = z;
+    }
+    return z;
+}
+
+/**
+ * Feeds a string into the stream. The compressed data is discarded, as
+ * only its length given by total_out is of interest.
+ * @param z state
+ * @param x string
+ * @param flush Z_NO_FLUSH or Z_FINISH
+ * @return zlib status code
+ */
+static int
+zstate_feed (zstate_t *z, hstring_t *x, int flush)
+{
+    z_stream *s = &z->strm;
+    size_t len = x->len;
+    int rc;
+
+    if (x->type == HSTRING_TYPE_TOKEN)
+        len *= sizeof(sym_t);
+
+    s->next_in = (Bytef *) x->str.c;
+    do {
+        /* Input larger than uInt is fed in pieces */
+        s->avail_in = len > (1U << 30) ? (1U << 30) : len;
+        len -= s->avail_in;
+        do {
+            s->next_out = z->out;
+            s->avail_out = COMPRESS_CHUNK;
+            rc = deflate(s, len > 0 ? Z_NO_FLUSH : flush);
+            if (rc == Z_STREAM_ERROR)
+                return rc;
+        } while (s->avail_out == 0 || s->avail_in > 0);
+    } while (len > 0);
+
+    return flush == Z_FINISH && rc != Z_STREAM_END ? Z_BUF_ERROR : Z_OK;
+}
+
+/**
+ * Compresses one string or the concatenation of two strings and returns
+ * the length of the compressed data. The result equals compress2().
+ * @param self measure
+ * @param x first string
+ * @param y second string or NULL
  * @return length of the compressed data
  */
 static float
-compress_str1 (measures_t *self, hstring_t *x)
+compress_len (measures_t *self, hstring_t *x, hstring_t *y)
 {
-    unsigned long tmp, width;
-    unsigned char *dst;
-
-    width = x->type == HSTRING_TYPE_TOKEN ? sizeof(sym_t) : sizeof(char);
-    tmp = compressBound(x->len * width);
+    zstate_t *z;
+    int tmp, rc;
+    float len;
 
-    dst = (unsigned char *) zmalloc(tmp);
-    if (!dst) {
-        error("Failed to allocate memory for compression");
+    z = zstate_get(self, &tmp);
+    if (!z)
         return -1;
+
+    deflateReset(&z->strm);
+    rc = zstate_feed(z, x, y ? Z_NO_FLUSH : Z_FINISH);
+    if (rc == Z_OK && y)
+        rc = zstate_feed(z, y, Z_FINISH);
+
+    if (rc != Z_OK) {
+        error("Failed to compress strings");
+        len = -1;
+    } else {
+        len = (float) z->strm.total_out;
     }
 
-    compress2(dst, &tmp, (const Bytef *) x->str.c, x->len * width, self->opts->level);
+    if (tmp)
+        zstate_free(z);
+    return len;
+}
 
-    free(dst);
-    return (float) tmp;
+/**
+ * Compress one string and return the length of the compressed data
+ * @param x String x
+ * @return length of the compressed data
+ */
+static float
+compress_str1 (measures_t *self, hstring_t *x)
+{
+    return compress_len(self, x, NULL);
 }
 
 /**
@@ -69,30 +183,10 @@ compress_str1 (measures_t *self, hstring_t *x)
 static float
 compress_str2 (measures_t *self, hstring_t *x, hstring_t *y)
 {
-    unsigned long tmp, width;
-    unsigned char *src, *dst;
-
     assert(x->type == y->type);
 
-    width = x->type == HSTRING_TYPE_TOKEN ? sizeof(sym_t) : sizeof(char);
-    tmp = compressBound((x->len + y->len) * width);
-
-    dst = (unsigned char *) zmalloc(tmp);
-    src = (unsigned char *) zmalloc(tmp);
-    if (!src || !dst) {
-        error("Failed to allocate memory for compression");
-        return -1;
-    }
-
     /* Concatenate sequences y and x */
-    memcpy(src, y->str.s, y->len * width);
-    memcpy(src + y->len * width, x->str.s, x->len * width);
-
-    compress2(dst, &tmp, src, (x->len + y->len) * width, self->opts->level);
-
-    free(dst);
-    free(src);
-    return (float) tmp;
+    return compress_len(self, y, x);
 }
 
 
@@ -194,6 +288,61 @@ dist_compression_test (bool verbose)
         hstring_destroy (&x);
         hstring_destroy (&y);
     }
+
+    //  Compare reused streams with compress2()
+    int j, n, len[] = {0, 10, 300, 5000, 9000}, level[] = {1, 4, 6, 9};
+    char *a = malloc (9001), *b = malloc (18002);
+    hstring_t *z[5];
+    srand (1234);
+
+    for (i = 0; i < 5; i++) {
+        for (j = 0; j < len[i]; j++)
+            a[j] = 'a' + rand () % (i + 2);
+        a[len[i]] = 0;
+        z[i] = hstring_new (a);
+    }
+
+    for (n = 0; n < 4 && !err; n++) {
+        measures_config_set_int (compression,
+                                 "measures.dist_compression.level", level[n]);
+        for (i = 0; i < 25 && !err; i++) {
+            x = z[i % 5];
+            y = z[(i / 5 + n) % 5];
+            memcpy (b, y->str.c, y->len);
+            memcpy (b + y->len, x->str.c, x->len);
+
+            unsigned long l1 = compressBound (x->len + y->len);
+            unsigned char *dst = malloc (l1);
+            compress2 (dst, &l1, (Bytef *) b, x->len + y->len, level[n]);
+            free (dst);
+
+            float l2 = compress_str2 (compression, x, y);
+            if (l2 != l1) {
+                printf ("Error %f != %lu (%d, %d)\n", l2, l1, y->len, x->len);
+                err = TRUE;
+            }
+
+            /* Reverse the order of the strings */
+            memcpy (b, x->str.c, x->len);
+            memcpy (b + x->len, y->str.c, y->len);
+            l1 = compressBound (x->len + y->len);
+            dst = malloc (l1);
+            compress2 (dst, &l1, (Bytef *) b, x->len + y->len, level[n]);
+            free (dst);
+
+            l2 = compress_str2 (compression, y, x);
+            if (l2 != l1) {
+                printf ("Error %f != %lu (%d, %d)\n", l2, l1, x->len, y->len);
+                err = TRUE;
+            }
+        }
+    }
+
+    for (i = 0; i < 5; i++)
+        hstring_destroy (&z[i]);
+    free (a);
+    free (b);
+    assert (!err);
     measures_destroy (&compression);
     //  @end
     //
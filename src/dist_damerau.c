@@ -23,14 +23,6 @@
 
 #include "harry_classes.h"
 
-//  Symbols hash table
-typedef struct
-{
-    sym_t sym;          /**< Symbol (key) */
-    int val;            /**< Value associated with symbol */
-    UT_hash_handle hh;  /**< Makes struct hashable */
-} sym_hash_t;
-
 //  Local helper functions
 
 /*
@@ -41,61 +33,66 @@ static float min(float a, float b, float c, float d)
     return fmin(fmin(a, b), fmin(c, d));
 }
 
-/**
- * Get value associated with a symbol from the hash
- * @param hash hash table
- * @param s symbol
- * @return value
+/*
+ * Alphabet of two strings. Symbols are mapped to dense ids, directly for
+ * bytes and bits and through an open-addressed table for tokens.
  */
-static int hash_get(sym_hash_t **hash, sym_t s)
+typedef struct
 {
-    sym_hash_t *entry = NULL;
-
-    HASH_FIND(hh, *hash, &s, sizeof(sym_t), entry);
-    if (!entry) {
-        entry = (sym_hash_t *) zmalloc(sizeof(sym_hash_t));
-        entry->sym = s;
-        entry->val = 0;
-        HASH_ADD(hh, *hash, sym, sizeof(sym_t), entry);
-    }
-
-    return entry->val;
-}
+    int *xs;            /**< Ids of symbols in x */
+    int *ys;            /**< Ids of symbols in y */
+    int size;           /**< Number of ids */
+} alpha_t;
 
-/**
- * Set the value of a symbol in the hash
- * @param hash hash table
- * @param s symbol
- * @param val value
+/*
+ * Map the symbols of two strings to ids. The ids are taken from the
+ * scratch memory of the measure and released with the caller's rows.
  */
-static void hash_set(sym_hash_t **hash, sym_t s, int val)
+static int alpha_init(measures_t *self, alpha_t *a, hstring_t *x, hstring_t *y)
 {
-    sym_hash_t *entry = NULL;
-
-    HASH_FIND(hh, *hash, &s, sizeof(sym_t), entry);
-    if (!entry) {
-        entry = (sym_hash_t *) zmalloc(sizeof(sym_hash_t));
-        entry->sym = s;
-        entry->val = val;
-        HASH_ADD(hh, *hash, sym, sizeof(sym_t), entry);
+    int i, n = x->len + y->len, cap = 16;
+
+    a->xs = (int *) measures_alloc(self, (n + 1) * sizeof(int));
+    if (!a->xs)
+        return FALSE;
+    a->ys = a->xs + x->len;
+
+    if (x->type != HSTRING_TYPE_TOKEN) {
+        for (i = 0; i < x->len; i++)
+            a->xs[i] = hstring_sym(x, i, x->type) & 0xff;
+        for (i = 0; i < y->len; i++)
+            a->ys[i] = hstring_sym(y, i, y->type) & 0xff;
+        a->size = 256;
+        return TRUE;
     }
 
-    entry->val = val;
-}
-
-/**
- * Destroy hash table
- * @param hash hash table
- */
-static void hash_destroy(sym_hash_t **hash)
-{
-    sym_hash_t *entry;
-
-    while (*hash) {
-        entry = *hash;
-        HASH_DEL(*hash, entry);
-        free(entry);
+    /* Open addressing with linear probing at load below one half */
+    while (cap < 2 * n)
+        cap *= 2;
+    sym_t *keys = (sym_t *) measures_alloc(self, cap * sizeof(sym_t));
+    int *ids = (int *) measures_alloc(self, cap * sizeof(int));
+    if (!keys || !ids) {
+        measures_release(self, a->xs);
+        return FALSE;
+    }
+    memset(ids, -1, cap * sizeof(int));
+
+    a->size = 0;
+    for (i = 0; i < n; i++) {
+        sym_t sym = i < x->len ? x->str.s[i] : y->str.s[i - x->len];
+        int h = (sym * 0x9e3779b97f4a7c15ULL) >> 32 & (cap - 1);
+        while (ids[h] >= 0 && keys[h] != sym)
+            h = (h + 1) & (cap - 1);
+        if (ids[h] < 0) {
+            keys[h] = sym;
+            ids[h] = a->size++;
+        }
+        a->xs[i] = ids[h];
     }
+
+    /* Releases the table but keeps the ids */
+    measures_release(self, keys);
+    return TRUE;
 }
 
 //  --------------------------------------------------------------------------
@@ -118,68 +115,192 @@ dist_damerau_config (measures_t *self)
     opts->lnorm = lnorm_get(str);
 }
 
-/* Ugly macros to access arrays */
-#define D(i,j)       d[(i) * (y->len + 2) + (j)]
+/* Value of unreachable cells */
+#define DAMERAU_INF     (INT_MAX / 2)
 
 //  --------------------------------------------------------------------------
-//  Computes the Damerau-Levenshtein distance of two strings. Adapted from
-//  Wikipedia entry and comments from Stackoverflow.com. Takes two strings and
-//  returns the edit distance consisting of insertions, deletions, replacements
-//  and transpositions weighted by costs in the configuration by default cost
-//  for each operation is 1.0. @TODO normalizations
+//  Minimum cost of an insertion or deletion. Costs are truncated when added
+//  to the integer cells and symbols skipped by transpositions cost 1.
 
-float
-dist_damerau_compare (measures_t *self, hstring_t *x, hstring_t *y)
+static inline double
+damerau_cost (measures_opts_t *opts)
+{
+    return fmin (floor (fmin (opts->cost_ins, opts->cost_del)), 1.0);
+}
+
+//  --------------------------------------------------------------------------
+//  Computes the Damerau-Levenshtein distance of two strings for a given
+//  string type. The type is a constant, such that one specialized loop is
+//  generated per type. Only the band of diagonals that can stay within the
+//  bound k is computed. A transposition across w rows costs at least w - 1,
+//  so the computation stops once more than k + 1 consecutive rows exceed
+//  the bound k and a value larger than k is returned.
+//
+//  A transposition of symbol s reads the row preceding the last occurrence
+//  of s in x. Instead of the full matrix, this row is kept for each symbol
+//  that also occurs in y, by handing over the buffer of the previous row.
+//  The memory is thus linear in the length of y times the shared symbols.
+
+HSTRING_INLINE float
+damerau (measures_t *self, hstring_t *x, hstring_t *y, double k,
+         const unsigned int type)
 {
     measures_opts_t *opts = self->opts;
-    sym_hash_t *shash = NULL;
-    int i, j, inf = x->len + y->len;
+    int i, j, over = 0, lo, hi, jlo, jhi;
+    double low = INFINITY, cost = damerau_cost (opts);
+    float r = 0;
+    alpha_t a;
 
-    if (x->len == 0 && y->len == 0)
-        return 0;
+    if (!measures_band (x->len, y->len, k, cost, &lo, &hi))
+        return cost * abs (y->len - x->len);
 
-    /* Allocate table for dynamic programming */
-    int *d = (int *) zmalloc((x->len + 2) * (y->len + 2) * sizeof(int));
-    if (!d) {
+    if (!alpha_init (self, &a, x, y)) {
         error("Could not allocate memory for Damerau-Levenshtein distance");
         return 0;
     }
 
-    /* Initialize distance matrix */
-    D(0, 0) = inf;
-    for (i = 0; i <= x->len; i++) {
-        D(i + 1, 1) = i;
-        D(i + 1, 0) = inf;
-    }
-    for (j = 0; j <= y->len; j++) {
-        D(1, j + 1) = j;
-        D(0, j + 1) = inf;
+    /* Last row of each symbol, its preceding row and occurrence in y */
+    int *last = (int *) measures_alloc (self, a.size * sizeof (int));
+    int **saved = (int **) measures_alloc (self, a.size * sizeof (int *));
+    char *iny = (char *) measures_alloc (self, a.size);
+    int *prev = (int *) measures_alloc (self, (y->len + 1) * sizeof (int));
+    int *cur = (int *) measures_alloc (self, (y->len + 1) * sizeof (int)), *t;
+    if (!last || !saved || !iny || !prev || !cur) {
+        error("Could not allocate memory for Damerau-Levenshtein distance");
+        goto clean;
     }
+    memset (last, 0, a.size * sizeof (int));
+    memset (saved, 0, a.size * sizeof (int *));
+    memset (iny, 0, a.size);
+
+    for (j = 0; j < y->len; j++)
+        iny[a.ys[j]] = 1;
+    for (j = 0; j <= y->len; j++)
+        prev[j] = j <= hi ? j : DAMERAU_INF;
 
     for (i = 1; i <= x->len; i++) {
-        int db = 0;
-        for (j = 1; j <= y->len; j++) {
-            int i1 = hash_get(&shash, hstring_get(y, j - 1));
+        int db = 0, rmin = i, s = a.xs[i - 1];
+        jlo = i + lo > 1 ? i + lo : 1;
+        jhi = i + hi < y->len ? i + hi : y->len;
+
+        /* Cells left of the band are unreachable */
+        cur[0] = i;
+        if (jlo > 1)
+            cur[jlo - 1] = DAMERAU_INF;
+
+        /* Last match left of the band, if a transposition can afford it */
+        for (j = jlo - 1; j >= 1 && jlo - j - 1 <= k; j--) {
+            if (a.ys[j - 1] == s) {
+                db = j;
+                break;
+            }
+        }
+
+        for (j = jlo; j <= jhi; j++) {
+            int i1 = last[a.ys[j - 1]];
             int j1 = db;
-            int dz = hstring_compare(x, i - 1, y, j - 1) ? opts->cost_sub : 0;
+            int dz = s == a.ys[j - 1] ? 0 : opts->cost_sub;
             if (dz == 0)
                 db = j;
 
-            D(i + 1, j + 1) = min(D(i, j) + dz,
-                                  D(i + 1, j) + opts->cost_ins,
-                                  D(i, j + 1) + opts->cost_del,
-                                  D(i1, j1) + (i - i1 - 1) + opts->cost_tra +
-                                  (j - j1 - 1));
+            /* Transpositions from cells outside the band are ignored */
+            int dt = DAMERAU_INF;
+            if (i1 > 0 && j1 > 0 &&
+                (i1 == 1 || j1 == 1 || (j1 - i1 >= lo && j1 - i1 <= hi)))
+                dt = saved[a.ys[j - 1]][j1 - 1] + (i - i1 - 1) +
+                     opts->cost_tra + (j - j1 - 1);
+
+            cur[j] = min(prev[j - 1] + dz, cur[j - 1] + opts->cost_ins,
+                         prev[j] + opts->cost_del, dt);
+            if (cur[j] < rmin)
+                rmin = cur[j];
+        }
+
+        /* Cells right of the band are unreachable */
+        if (jhi < y->len)
+            cur[jhi + 1] = DAMERAU_INF;
+
+        /* Keep the preceding row of the symbol and rotate buffers */
+        last[s] = i;
+        if (iny[s]) {
+            t = saved[s];
+            saved[s] = prev;
+            prev = cur;
+            cur = t ? t : (int *) measures_alloc (self, (y->len + 1) * sizeof (int));
+            if (!cur) {
+                error("Could not allocate memory for Damerau-Levenshtein distance");
+                goto clean;
+            }
+        } else {
+            t = prev, prev = cur, cur = t;
         }
 
-        hash_set(&shash, hstring_get(x, i - 1), i);
+        /* Track run of rows exceeding the bound */
+        if (rmin > k) {
+            low = fmin(low, rmin);
+            if (++over - 1 > k) {
+                r = fmin(low, over - 1);
+                goto clean;
+            }
+        } else {
+            low = INFINITY;
+            over = 0;
+        }
     }
 
-    float r = D(x->len + 1, y->len + 1);
+    r = prev[y->len];
 
-    /* Free memory */
-    free(d);
-    hash_destroy(&shash);
+clean:
+    /* Release all rows allocated after the ids */
+    measures_release (self, a.xs);
+
+    return r;
+}
+
+//  --------------------------------------------------------------------------
+//  Computes the Damerau-Levenshtein distance in a band of diagonals. Without
+//  a bound the band is doubled until the distance lies within (Ukkonen),
+//  such that the run-time is O(d * n) for a distance d.
+
+HSTRING_INLINE float
+damerau_band (measures_t *self, hstring_t *x, hstring_t *y, double k,
+              const unsigned int type)
+{
+    double c = damerau_cost (self->opts);
+    double b = c * (abs (y->len - x->len) + MEASURES_BAND);
+    float r;
+
+    if (k < INFINITY)
+        return damerau (self, x, y, k, type);
+
+    for (;; b *= 2) {
+        if (b >= c * (x->len + y->len))
+            return damerau (self, x, y, INFINITY, type);
+        r = damerau (self, x, y, b, type);
+        if (r <= b)
+            return r;
+    }
+}
+
+//  --------------------------------------------------------------------------
+//  Computes the Damerau-Levenshtein distance of two strings. Adapted from
+//  Wikipedia entry and comments from Stackoverflow.com. Takes two strings and
+//  returns the edit distance consisting of insertions, deletions, replacements
+//  and transpositions weighted by costs in the configuration by default cost
+//  for each operation is 1.0. @TODO normalizations
+
+float
+dist_damerau_compare (measures_t *self, hstring_t *x, hstring_t *y)
+{
+    measures_opts_t *opts = self->opts;
+    float r;
+
+    if (x->len == 0 && y->len == 0)
+        return 0;
+
+    /* Normalized distances are filtered afterwards only */
+    double k = opts->lnorm == LN_NONE ? opts->max_dist : INFINITY;
+    HSTRING_SPECIALIZE(r, x->type, damerau_band, self, x, y, k);
 
     if (opts->lnorm == LN_NONE)
         return r;
@@ -247,6 +368,13 @@ static struct hstring_test tests[] = {
     {NULL}
 };
 
+// Without bound the band covers the full matrix
+static float
+damerau_full (measures_t *self, hstring_t *x, hstring_t *y)
+{
+    return damerau (self, x, y, INFINITY, HSTRING_TYPE_BYTE);
+}
+
 void
 dist_damerau_test (bool verbose)
 {
@@ -274,10 +402,62 @@ dist_damerau_test (bool verbose)
             err = TRUE;
         }
 
+        //  Bounded distances are exact or exceed the bound
+        measures_config_set_float (damerau, "measures.max_distance",
+                                   tests[i].v);
+        err |= measures_compare (damerau, x, y) != d;
+        measures_config_set_float (damerau, "measures.max_distance",
+                                   tests[i].v / 2 - 0.5);
+        float b = measures_compare (damerau, x, y);
+        err |= d > 0 && b <= tests[i].v / 2 - 0.5;
+        measures_config_set_float (damerau, "measures.max_distance", -1);
+
         hstring_destroy (&x);
         hstring_destroy (&y);
     }
+
+    //  Banded variants match the full matrix
+    char a[200], b[200];
+    srand (4321);
+    for (i = 0; i < 300 && !err; i++) {
+        int j, n = rand () % 200, m = n / 2 + rand () % (n / 2 + 1);
+        for (j = 0; j < n; j++)
+            a[j] = b[j] = 'a' + rand () % 4;
+        for (j = 0; j < n / 8; j++)
+            b[rand () % n] = 'a' + rand () % 4;
+        a[n] = b[m] = 0;
+
+        x = hstring_new (a);
+        y = hstring_new (b);
+        hstring_preproc (x, damerau);
+        hstring_preproc (y, damerau);
+
+        float d = damerau_full (damerau, x, y);
+        float e = damerau_band (damerau, x, y, INFINITY, HSTRING_TYPE_BYTE);
+        double k = rand () % 100;
+        float f = damerau_band (damerau, x, y, k, HSTRING_TYPE_BYTE);
+        if (d != e || (d <= k ? f != d : f <= k)) {
+            printf ("Error %f, %f, %f (bound %f)\n", d, e, f, k);
+            err = TRUE;
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
+
+    //  Tokens are mapped to ids of a flat table
+    measures_config_set_string (damerau, "measures.granularity", "tokens");
+    hstring_delim_set (".");
+    x = hstring_new ("ab.cd.ef.ab");
+    y = hstring_new ("cd.ab.ef.gh");
+    hstring_preproc (x, damerau);
+    hstring_preproc (y, damerau);
+    err |= measures_compare (damerau, x, y) != 2;
+    hstring_destroy (&x);
+    hstring_destroy (&y);
+
     measures_destroy (&damerau);
+    assert (!err);
     //  @end
 
     printf(" OK\n");
@@ -11,6 +11,15 @@
 
 #include "harry_classes.h"
 
+#if SIMD_X86
+#include <immintrin.h>
+#elif SIMD_ARM
+#include <arm_neon.h>
+#endif
+
+/* Number of bytes between checks of the bound */
+#define HAMMING_BLOCK   256
+
 /**
  * @addtogroup measures
  * <hr>
@@ -35,6 +44,223 @@ void dist_hamming_config(measures_t *self)
     opts->lnorm = lnorm_get(str);
 }
 
+/**
+ * Counts mismatching symbols of two strings for a given string type.
+ * The remaining symbols of the longer string are counted upfront, so
+ * that counting can stop as soon as the bound k is exceeded.
+ * @param x first string
+ * @param y second string
+ * @param k bound on distance (INFINITY for none)
+ * @param type string type
+ * @return number of mismatches
+ */
+HSTRING_INLINE float
+hamming(hstring_t *x, hstring_t *y, double k, const unsigned int type)
+{
+    float d = fabs(y->len - x->len);
+    int i;
+
+    for (i = 0; i < x->len && i < y->len && d <= k; i++)
+        if (!hstring_equal(x, i, y, i, type))
+            d += 1;
+
+    return d;
+}
+
+/**
+ * Counts mismatching bytes using eight bytes per word. Each mismatching
+ * byte leaves a non-zero byte in the XOR of two words that is folded
+ * into its lowest bit and counted.
+ * @param x first array
+ * @param y second array
+ * @param n number of bytes
+ * @param k bound on distance
+ * @param d mismatches counted so far
+ * @return number of mismatches
+ */
+static double
+mismatch_bytes_swar(const char *x, const char *y, size_t n, double k,
+                    double d)
+{
+    const uint64_t lo = 0x0101010101010101ULL;
+    uint64_t a, b, v;
+    size_t i = 0;
+
+    for (; i + 8 <= n && d <= k; i += 8) {
+        memcpy(&a, x + i, 8);
+        memcpy(&b, y + i, 8);
+        v = a ^ b;
+        v |= v >> 4;
+        v |= v >> 2;
+        v |= v >> 1;
+        d += __builtin_popcountll(v & lo);
+    }
+
+    for (; i < n && d <= k; i++)
+        d += x[i] != y[i];
+
+    return d;
+}
+
+/**
+ * Counts differing bits of two arrays using 64-bit words.
+ * @param x first array
+ * @param y second array
+ * @param n number of bytes
+ * @param k bound on distance
+ * @param d mismatches counted so far
+ * @return number of mismatches
+ */
+HSTRING_INLINE double
+mismatch_words(const char *x, const char *y, size_t n, double k, double d)
+{
+    uint64_t a, b;
+    size_t i;
+
+    for (i = 0; i + 8 <= n && d <= k; i += 8) {
+        memcpy(&a, x + i, 8);
+        memcpy(&b, y + i, 8);
+        d += __builtin_popcountll(a ^ b);
+    }
+
+    for (; i < n; i++)
+        d += __builtin_popcount((unsigned char) (x[i] ^ y[i]));
+
+    return d;
+}
+
+#if SIMD_X86
+__attribute__ ((target ("avx2,popcnt")))
+static double
+mismatch_bytes_avx2(const char *x, const char *y, size_t n, double k,
+                    double d)
+{
+    __m256i a, b;
+    size_t i = 0, e;
+
+    while (i + 32 <= n && d <= k) {
+        e = i + HAMMING_BLOCK < n ? i + HAMMING_BLOCK : n;
+        for (; i + 32 <= e; i += 32) {
+            a = _mm256_loadu_si256((const __m256i *) (x + i));
+            b = _mm256_loadu_si256((const __m256i *) (y + i));
+            d += 32 - __builtin_popcount(
+                    (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)));
+        }
+    }
+
+    return mismatch_bytes_swar(x + i, y + i, n - i, k, d);
+}
+
+__attribute__ ((target ("sse4.2,popcnt")))
+static double
+mismatch_bytes_sse42(const char *x, const char *y, size_t n, double k,
+                     double d)
+{
+    __m128i a, b;
+    size_t i = 0, e;
+
+    while (i + 16 <= n && d <= k) {
+        e = i + HAMMING_BLOCK < n ? i + HAMMING_BLOCK : n;
+        for (; i + 16 <= e; i += 16) {
+            a = _mm_loadu_si128((const __m128i *) (x + i));
+            b = _mm_loadu_si128((const __m128i *) (y + i));
+            d += 16 - __builtin_popcount(
+                    (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)));
+        }
+    }
+
+    return mismatch_bytes_swar(x + i, y + i, n - i, k, d);
+}
+
+__attribute__ ((target ("popcnt")))
+static double
+mismatch_words_popcnt(const char *x, const char *y, size_t n, double k,
+                      double d)
+{
+    return mismatch_words(x, y, n, k, d);
+}
+#elif SIMD_ARM
+static double
+mismatch_bytes_neon(const char *x, const char *y, size_t n, double k,
+                    double d)
+{
+    uint8x16_t a, b;
+    size_t i = 0, e;
+
+    while (i + 16 <= n && d <= k) {
+        e = i + HAMMING_BLOCK < n ? i + HAMMING_BLOCK : n;
+        for (; i + 16 <= e; i += 16) {
+            a = vld1q_u8((const uint8_t *) (x + i));
+            b = vld1q_u8((const uint8_t *) (y + i));
+            d += 16 - vaddvq_u8(vshrq_n_u8(vceqq_u8(a, b), 7));
+        }
+    }
+
+    return mismatch_bytes_swar(x + i, y + i, n - i, k, d);
+}
+#endif
+
+/**
+ * Computes the Hamming distance of two byte strings with the kernel
+ * for the given level of vector instructions.
+ * @param x first string
+ * @param y second string
+ * @param k bound on distance (INFINITY for none)
+ * @param level vector instructions (SIMD_NONE, ...)
+ * @return number of mismatches
+ */
+static double
+hamming_bytes(hstring_t *x, hstring_t *y, double k, int level)
+{
+    size_t n = MIN(x->len, y->len);
+    double d = abs(y->len - x->len);
+
+    switch (level) {
+#if SIMD_X86
+    case SIMD_AVX2:
+        return mismatch_bytes_avx2(x->str.c, y->str.c, n, k, d);
+    case SIMD_SSE42:
+        return mismatch_bytes_sse42(x->str.c, y->str.c, n, k, d);
+#elif SIMD_ARM
+    case SIMD_NEON:
+        return mismatch_bytes_neon(x->str.c, y->str.c, n, k, d);
+#endif
+    default:
+        return mismatch_bytes_swar(x->str.c, y->str.c, n, k, d);
+    }
+}
+
+/**
+ * Computes the Hamming distance of two bit strings. Bits are packed
+ * from the most significant bit, such that the bits of a partial last
+ * byte are masked from the top.
+ * @param x first string
+ * @param y second string
+ * @param k bound on distance (INFINITY for none)
+ * @param level vector instructions (SIMD_NONE, ...)
+ * @return number of mismatches
+ */
+static double
+hamming_bits(hstring_t *x, hstring_t *y, double k, int level)
+{
+    size_t n = MIN(x->len, y->len);
+    double d = abs(y->len - x->len);
+    unsigned char r;
+
+#if SIMD_X86
+    if (level >= SIMD_SSE42)
+        d = mismatch_words_popcnt(x->str.c, y->str.c, n / 8, k, d);
+    else
+#endif
+        d = mismatch_words(x->str.c, y->str.c, n / 8, k, d);
+
+    if (n % 8 == 0)
+        return d;
+
+    r = (x->str.c[n / 8] ^ y->str.c[n / 8]) & (0xff << (8 - n % 8));
+    return d + __builtin_popcount(r);
+}
+
 /**
  * Computes the Hamming distance of two strings. If the strings have
  * different lengths, the remaining symbols of the longer string are
@@ -46,16 +272,16 @@ void dist_hamming_config(measures_t *self)
 float dist_hamming_compare(measures_t *self, hstring_t *x, hstring_t *y)
 {
     measures_opts_t *opts = self->opts;
-    float d = 0;
-    int i;
+    float d;
 
-    /* Loop over strings */
-    for (i = 0; i < x->len && i < y->len; i++)
-        if (hstring_compare(x, i, y, i))
-            d += 1;
-
-    /* Add remaining characters as mismatches */
-    d += fabs(y->len - x->len);
+    /* Loop over strings. Normalized distances are filtered afterwards */
+    double k = opts->lnorm == LN_NONE ? opts->max_dist : INFINITY;
+    if (x->type == HSTRING_TYPE_BYTE)
+        d = hamming_bytes(x, y, k, simd_level());
+    else if (x->type == HSTRING_TYPE_BIT)
+        d = hamming_bits(x, y, k, simd_level());
+    else
+        HSTRING_SPECIALIZE(d, x->type, hamming, x, y, k);
 
     return lnorm(opts->lnorm, d, x, y);
 }
@@ -119,23 +345,23 @@ dist_hamming_test (bool verbose)
     //  @selftest
     int i, err = FALSE;
     hstring_t *x, *y;
-    measures_t *hamming = measures_new ("dist_hamming");
-    assert (hamming);
+    measures_t *measure = measures_new ("dist_hamming");
+    assert (measure);
 
     for (i = 0; tests[i].x && !err; i++) {
         x = hstring_new (tests[i].x);
         y = hstring_new (tests[i].y);
 
         if (strlen(tests[i].delim) == 0)
-            measures_config_set_string(hamming, "measures.granularity", "bytes");
+            measures_config_set_string(measure, "measures.granularity", "bytes");
         else
-            measures_config_set_string(hamming, "measures.granularity", "tokens");
+            measures_config_set_string(measure, "measures.granularity", "tokens");
         hstring_delim_set (tests[i].delim);
 
-        hstring_preproc (x, hamming);
-        hstring_preproc (y, hamming);
+        hstring_preproc (x, measure);
+        hstring_preproc (y, measure);
 
-        float d = measures_compare(hamming, x, y);
+        float d = measures_compare(measure, x, y);
         double diff = fabs (tests[i].v - d);
 
         if (diff > 1e-6) {
@@ -148,7 +374,65 @@ dist_hamming_test (bool verbose)
         hstring_destroy(&x);
         hstring_destroy(&y);
     }
-    measures_destroy (&hamming);
+
+    //  Compare vector kernels and scalar loop
+    char a[300], b[300];
+    const char *gran[] = {"bytes", "bits"};
+    srand (1234);
+
+    for (i = 0; i < 400 && !err; i++) {
+        int j, level, n = rand () % 300, m = rand () % 300;
+        for (j = 0; j < n; j++)
+            a[j] = 1 + rand () % 255;
+        for (j = 0; j < m; j++)
+            b[j] = rand () % 4 ? a[j % (n + 1)] | 1 : 1 + rand () % 255;
+        a[n] = b[m] = 0;
+
+        measures_config_set_string (measure, "measures.granularity",
+                                    gran[i % 2]);
+        x = hstring_new (a);
+        y = hstring_new (b);
+        hstring_preproc (x, measure);
+        hstring_preproc (y, measure);
+
+        //  Partial last bytes of bit strings
+        if (x->type == HSTRING_TYPE_BIT) {
+            x->len -= MIN (x->len, rand () % 8);
+            y->len -= MIN (y->len, rand () % 8);
+        }
+
+        float d1, d2;
+        double k = rand () % 100;
+        HSTRING_SPECIALIZE (d1, x->type, hamming, x, y, INFINITY);
+
+        for (level = SIMD_NONE; level <= simd_level () && !err; level++) {
+            if (x->type == HSTRING_TYPE_BYTE) {
+                d2 = hamming_bytes (x, y, INFINITY, level);
+            } else {
+                d2 = hamming_bits (x, y, INFINITY, level);
+            }
+            if (d1 != d2) {
+                printf ("\nError %f != %f (level %d)\n", d2, d1, level);
+                err = TRUE;
+            }
+
+            //  Bounded kernels are exact below and exceed the bound above
+            if (x->type == HSTRING_TYPE_BYTE) {
+                d2 = hamming_bytes (x, y, k, level);
+            } else {
+                d2 = hamming_bits (x, y, k, level);
+            }
+            if ((d1 <= k && d2 != d1) || (d1 > k && d2 <= k)) {
+                printf ("\nError %f != %f (bound %f)\n", d2, d1, k);
+                err = TRUE;
+            }
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
+    measures_destroy (&measure);
+    assert (!err);
     //  @end
 
     printf(" OK\n");
@@ -35,15 +35,16 @@
  * @{
  */
 
-/* Global variables */
+/* Maximum length of the shorter string for bit-parallel matching */
+#define JARO_WORDS      2
+#define JARO_BITS       (64 * JARO_WORDS)
+#define JARO_TABLE      (2 * JARO_BITS)
 
-#ifdef JARO_COMPARE_SERRANO
 /* Some help functions */
 static inline int max(int x, int y)
 {
     return x > y ? x : y;
 }
-#endif
 
 static inline int min(int x, int y)
 {
@@ -68,9 +69,12 @@ void dist_jarowinkler_config(measures_t *self)
  * from implementation by Miguel Serrano
  * @param x first string
  * @param y second string
+ * @param type string type
  * @return Jaro distance
  */
-static float dist_jaro_compare_serrano(hstring_t *x, hstring_t *y)
+HSTRING_INLINE float
+dist_jaro_compare_serrano(measures_t *self, hstring_t *x, hstring_t *y,
+                          const unsigned int type)
 {
     int i, j, l;
     int m = 0, t = 0;
@@ -79,22 +83,18 @@ static float dist_jaro_compare_serrano(hstring_t *x, hstring_t *y)
     if (x->len == 0 && y->len == 0)
         return 0.0;
 
-    char *xflags = calloc(sizeof(char), x->len);
+    char *xflags = measures_alloc(self, x->len + y->len);
     if (!xflags) {
         error("Could not allocate memory for Jaro distance");
         return 0;
     }
-
-    char *yflags = calloc(sizeof(char), y->len);
-    if (!yflags) {
-        error("Could not allocate memory for Jaro distance");
-        return 0;
-    }
+    char *yflags = xflags + x->len;
+    memset(xflags, 0, x->len + y->len);
 
     /* Calculate matching characters */
     for (i = 0; i < y->len; i++) {
         for (j = max(i - range, 0), l = min(i + range + 1, x->len); j < l; j++) {
-            if (!hstring_compare(y, i, x, j) && !xflags[j]) {
+            if (hstring_equal(y, i, x, j, type) && !xflags[j]) {
                 xflags[j] = 1;
                 yflags[i] = 1;
                 m++;
@@ -103,8 +103,10 @@ static float dist_jaro_compare_serrano(hstring_t *x, hstring_t *y)
         }
     }
 
-    if (m == 0)
+    if (m == 0) {
+        measures_release(self, xflags);
         return 1.0;
+    }
 
     /* Calculate character transpositions */
     l = 0;
@@ -116,31 +118,49 @@ static float dist_jaro_compare_serrano(hstring_t *x, hstring_t *y)
                     break;
                 }
             }
-            if (hstring_compare(y, i, x, j))
+            if (!hstring_equal(y, i, x, j, type))
                 t++;
         }
     }
     t /= 2;
 
-    free(xflags);
-    free(yflags);
+    measures_release(self, xflags);
 
     return 1 - ((((float) m / x->len) + ((float) m / y->len) +
                  ((float) (m - t) / m)) / 3.0);
 }
 #else
+/**
+ * Upper bound on the Jaro similarity for at most m matches, that is,
+ * a lower bound on the distance.
+ * @param x shorter string
+ * @param y longer string
+ * @param m maximum number of matches
+ * @return lower bound on Jaro distance
+ */
+static inline float jaro_bound(hstring_t *x, hstring_t *y, int m)
+{
+    float md = (float) m;
+    return 1.0 - (md / x->len + md / y->len + 1.0) / 3.0;
+}
+
 /**
  * Computes the Jaro distance of two strings. Code adapted from
- * from implementation by David Necas (Yeti).
+ * from implementation by David Necas (Yeti). The matching stops early
+ * if the remaining symbols cannot push the distance below the bound k.
  * @param x first string
  * @param y second string
- * @return Jaro distance
+ * @param k bound on distance (INFINITY for none)
+ * @param type string type
+ * @return Jaro distance or lower bound larger than k
  */
-static float dist_jaro_compare_yeti(hstring_t *x, hstring_t *y)
+HSTRING_INLINE float
+dist_jaro_compare_yeti(measures_t *self, hstring_t *x, hstring_t *y, double k,
+                       const unsigned int type)
 {
     int i, j, halflen, trans, match, to;
     int *idx;
-    float md;
+    float md, lb;
 
     if (x->len == 0 || y->len == 0) {
         if (x->len == 0 && y->len == 0)
@@ -156,12 +176,19 @@ static float dist_jaro_compare_yeti(hstring_t *x, hstring_t *y)
         y = z;
     }
 
+    /* At most all symbols of the shorter string match */
+    lb = jaro_bound(x, y, x->len);
+    if (lb > k)
+        return lb;
+
     halflen = (x->len + 1) / 2;
-    idx = (int *) calloc(x->len, sizeof(int));
+    to = x->len + halflen < y->len ? x->len + halflen : y->len;
+    idx = (int *) measures_alloc(self, x->len * sizeof(int));
     if (!idx) {
         error("Failed to allocate memory for Jaro distance");
         return 0;
     }
+    memset(idx, 0, x->len * sizeof(int));
 
     /* The literature about Jaro metric is confusing as the method of assigment
      * of common characters is nowhere specified.  There are several possible
@@ -174,27 +201,30 @@ static float dist_jaro_compare_yeti(hstring_t *x, hstring_t *y)
     /* the part with allowed range overlapping left */
     for (i = 0; i < halflen; i++) {
         for (j = 0; j < i + halflen; j++) {
-            if (!hstring_compare(x, j, y, i) && !idx[j]) {
+            if (hstring_equal(x, j, y, i, type) && !idx[j]) {
                 match++;
                 idx[j] = match;
                 break;
             }
         }
+        if (k < 1.0 && (lb = jaro_bound(x, y, min(x->len, match + to - i - 1))) > k)
+            goto abort;
     }
 
     /* the part with allowed range overlapping right */
-    to = x->len + halflen < y->len ? x->len + halflen : y->len;
     for (i = halflen; i < to; i++) {
         for (j = i - halflen; j < x->len; j++) {
-            if (!hstring_compare(x, j, y, i) && !idx[j]) {
+            if (hstring_equal(x, j, y, i, type) && !idx[j]) {
                 match++;
                 idx[j] = match;
                 break;
             }
         }
+        if (k < 1.0 && (lb = jaro_bound(x, y, min(x->len, match + to - i - 1))) > k)
+            goto abort;
     }
     if (!match) {
-        free(idx);
+        measures_release(self, idx);
         return 1.0;
     }
     /* count transpositions */
@@ -207,28 +237,178 @@ static float dist_jaro_compare_yeti(hstring_t *x, hstring_t *y)
                 trans++;
         }
     }
-    free(idx);
+    measures_release(self, idx);
+
+    md = (float) match;
+    return 1.0 - (md / x->len + md / y->len + 1.0 - trans / md / 2.0) / 3.0;
+
+abort:
+    measures_release(self, idx);
+    return lb;
+}
+
+/**
+ * Returns the slot of a symbol in an open-addressed table of position
+ * masks. The slot is empty if the symbol is not contained.
+ * @param keys symbols of slots
+ * @param full flags of used slots
+ * @param s symbol
+ * @param bits logarithm of table size
+ * @return slot of symbol
+ */
+static inline int jaro_slot(sym_t *keys, uint8_t *full, sym_t s, int bits)
+{
+    int h = (s * 0x9E3779B97F4A7C15ULL) >> (64 - bits);
+
+    while (full[h] && keys[h] != s)
+        h = (h + 1) & ((1 << bits) - 1);
+    return h;
+}
+
+/**
+ * Returns a mask of the positions [lo, hi) within a 64-bit word.
+ * @param lo first position relative to word
+ * @param hi end position relative to word
+ * @return mask of positions
+ */
+static inline uint64_t jaro_range(int lo, int hi)
+{
+    lo = max(lo, 0);
+    hi = min(hi, 64);
+    if (lo >= hi)
+        return 0;
+    return (hi == 64 ? ~0ULL : (1ULL << hi) - 1) & ~((1ULL << lo) - 1);
+}
+
+/**
+ * Bit-parallel variant of the matching by David Necas (Yeti). Each
+ * symbol of x is mapped to a mask of its positions, such that the
+ * earliest unassigned match within the window of a symbol of y is the
+ * lowest bit of the mask, the window and the unassigned positions.
+ * Matches and transpositions are identical to the original loop.
+ * @param x shorter string with at most JARO_BITS symbols
+ * @param y longer string
+ * @param k bound on distance (INFINITY for none)
+ * @param type string type
+ * @return Jaro distance or lower bound larger than k
+ */
+HSTRING_INLINE float
+jaro_bits(hstring_t *x, hstring_t *y, double k, const unsigned int type)
+{
+    sym_t keys[JARO_TABLE];
+    uint64_t masks[JARO_TABLE][JARO_WORDS], used[JARO_WORDS] = {0}, c;
+    uint8_t full[JARO_TABLE];
+    int idx[JARO_BITS];
+    int i, j, w, h, lo, hi, halflen, to, match = 0, trans = 0, bits = 1;
+    int words = (x->len + 63) / 64;
+    float md, lb;
+
+    /* At most all symbols of the shorter string match */
+    lb = jaro_bound(x, y, x->len);
+    if (lb > k)
+        return lb;
+
+    /* Position masks of the symbols in x */
+    while ((1 << bits) < 2 * x->len)
+        bits++;
+    memset(full, 0, 1 << bits);
+    for (j = 0; j < x->len; j++) {
+        h = jaro_slot(keys, full, hstring_sym(x, j, type), bits);
+        if (!full[h]) {
+            full[h] = 1;
+            keys[h] = hstring_sym(x, j, type);
+            memset(masks[h], 0, sizeof(masks[h]));
+        }
+        masks[h][j / 64] |= 1ULL << (j % 64);
+    }
+
+    halflen = (x->len + 1) / 2;
+    to = min(x->len + halflen, y->len);
+    for (i = 0; i < to; i++) {
+        h = jaro_slot(keys, full, hstring_sym(y, i, type), bits);
+        lo = max(i - halflen, 0);
+        hi = min(i + halflen, x->len);
+        for (w = 0; full[h] && w < words; w++) {
+            c = masks[h][w] & ~used[w] & jaro_range(lo - 64 * w, hi - 64 * w);
+            if (c) {
+                used[w] |= c & -c;
+                idx[64 * w + __builtin_ctzll(c)] = ++match;
+                break;
+            }
+        }
+        if (k < 1.0 && (lb = jaro_bound(x, y, min(x->len, match + to - i - 1))) > k)
+            return lb;
+    }
+    if (!match)
+        return 1.0;
+
+    /* count transpositions in the order of x */
+    for (i = 0, w = 0; w < words; w++)
+        for (c = used[w]; c; c &= c - 1)
+            if (idx[64 * w + __builtin_ctzll(c)] != ++i)
+                trans++;
 
     md = (float) match;
     return 1.0 - (md / x->len + md / y->len + 1.0 - trans / md / 2.0) / 3.0;
 }
+
+/**
+ * Computes the Jaro distance of two strings. If the shorter string has
+ * at most JARO_BITS symbols, the matching is computed bit-parallel.
+ * @param x first string
+ * @param y second string
+ * @param k bound on distance (INFINITY for none)
+ * @return Jaro distance or lower bound larger than k
+ */
+static float dist_jaro_compare_bits(measures_t *self, hstring_t *x, hstring_t *y,
+                                   double k)
+{
+    hstring_t *z;
+    float d;
+
+    if (x->len > y->len) {
+        z = x;
+        x = y;
+        y = z;
+    }
+
+    if (x->len == 0 || x->len > JARO_BITS)
+        HSTRING_SPECIALIZE(d, x->type, dist_jaro_compare_yeti, self, x, y, k);
+    else
+        HSTRING_SPECIALIZE(d, x->type, jaro_bits, x, y, k);
+    return d;
+}
 #endif
 
 /**
- * Computes the Jaro-Winkler distance of two strings.
+ * Computes the Jaro distance with a bound for early termination.
  * @param x first string
  * @param y second string
- * @return Jaro-Winkler distance
+ * @param k bound on distance (INFINITY for none)
+ * @return Jaro distance
  */
-float dist_jaro_compare(measures_t *self, hstring_t *x, hstring_t *y)
+static float jaro(measures_t *self, hstring_t *x, hstring_t *y, double k)
 {
 #ifdef JARO_COMPARE_SERRANO
-    return dist_jaro_compare_serrano(x, y);
+    float d;
+    HSTRING_SPECIALIZE(d, x->type, dist_jaro_compare_serrano, self, x, y);
+    return d;
 #else
-    return dist_jaro_compare_yeti(x, y);
+    return dist_jaro_compare_bits(self, x, y, k);
 #endif
 }
 
+/**
+ * Computes the Jaro distance of two strings.
+ * @param x first string
+ * @param y second string
+ * @return Jaro distance
+ */
+float dist_jaro_compare(measures_t *self, hstring_t *x, hstring_t *y)
+{
+    return jaro(self, x, y, self->opts->max_dist);
+}
+
 /**
  * Computes the Jaro-Winkler distance of two strings.
  * @param x first string
@@ -239,7 +419,6 @@ float dist_jarowinkler_compare(measures_t *self, hstring_t *x, hstring_t *y)
 {
     measures_opts_t *opts = self->opts;
     int l;
-    float d = dist_jaro_compare(self, x, y);
 
     /* Calculate common string prefix up to 4 chars */
     int m = min(min(x->len, y->len), 4);
@@ -247,6 +426,10 @@ float dist_jarowinkler_compare(measures_t *self, hstring_t *x, hstring_t *y)
         if (hstring_compare(x, l, y, l))
             break;}
 
+    /* The prefix scales the bound on the Jaro distance */
+    double s = 1 - l * opts->scaling;
+    float d = jaro(self, x, y, s > 0 ? opts->max_dist / s : INFINITY);
+
     /* Jaro-Winkler distance */
     return d - l * opts->scaling * d;
 }
@@ -327,6 +510,43 @@ dist_jarowinkler_test (bool verbose)
         hstring_destroy (&x);
         hstring_destroy (&y);
     }
+
+#ifndef JARO_COMPARE_SERRANO
+    //  Compare bit-parallel and original matching
+    char a[200], b[200];
+    const char *gran[] = {"bytes", "tokens"};
+    hstring_delim_set (".");
+    srand (1234);
+
+    for (i = 0; i < 1000 && !err; i++) {
+        int j, n = rand () % 200, m = rand () % 200;
+        for (j = 0; j < n; j++)
+            a[j] = '.' + rand () % 5;
+        for (j = 0; j < m; j++)
+            b[j] = '.' + rand () % 5;
+        a[n] = b[m] = 0;
+
+        measures_config_set_string (jarowinkler, "measures.granularity",
+                                    gran[i % 2]);
+        x = hstring_new (a);
+        y = hstring_new (b);
+        hstring_preproc (x, jarowinkler);
+        hstring_preproc (y, jarowinkler);
+
+        double k = rand () % 2 ? INFINITY : rand () / (double) RAND_MAX;
+        float d1 = dist_jaro_compare_yeti (jarowinkler, x, y, k, x->type);
+        float d2 = dist_jaro_compare_bits (jarowinkler, x, y, k);
+
+        if (fabs (d1 - d2) > 1e-6) {
+            printf ("Error %f != %f (%d, %d)\n", d2, d1, x->len, y->len);
+            err = TRUE;
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
+    assert (!err);
+#endif
     //  @end
     measures_destroy (&jarowinkler);
 
@@ -11,6 +11,15 @@
 
 #include "harry_classes.h"
 
+#if SIMD_X86
+#include <immintrin.h>
+#elif SIMD_ARM
+#include <arm_neon.h>
+#endif
+
+/* Number of bytes between flushes of the 32-bit sums */
+#define LEE_BLOCK       4096
+
 /**
  * @addtogroup measures
  * <hr>
@@ -33,6 +42,181 @@ void dist_lee_config(measures_t *self)
     config_lookup_int(self->cfg, "measures.dist_lee.max_sym", &opts->max_sym);
 }
 
+/*
+ * The vector kernels compute the distance of the common part of two byte
+ * strings in 16-bit lanes. Bytes are widened with the signedness of char,
+ * such that the differences match those of hstring_compare(). A kernel
+ * returns -1 if a difference exceeds the alphabet, so that the scalar
+ * loop can handle and report this case.
+ */
+#if SIMD_X86
+#if CHAR_MIN < 0
+#define LEE_WIDEN256    _mm256_cvtepi8_epi16
+#define LEE_WIDEN128    _mm_cvtepi8_epi16
+#else
+#define LEE_WIDEN256    _mm256_cvtepu8_epi16
+#define LEE_WIDEN128    _mm_cvtepu8_epi16
+#endif
+
+__attribute__ ((target ("avx2")))
+static int64_t
+lee_bytes_avx2(const char *x, const char *y, size_t n, int min, int q)
+{
+    const __m256i vmin = _mm256_set1_epi16(min);
+    const __m256i vq = _mm256_set1_epi16(q);
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i a, b, ad, over = _mm256_setzero_si256(), sum;
+    __m128i s;
+    int64_t d = 0;
+    size_t i = 0, e;
+
+    while (i + 16 <= n) {
+        e = i + LEE_BLOCK < n ? i + LEE_BLOCK : n;
+        sum = _mm256_setzero_si256();
+        for (; i + 16 <= e; i += 16) {
+            a = LEE_WIDEN256(_mm_loadu_si128((const __m128i *) (x + i)));
+            b = LEE_WIDEN256(_mm_loadu_si128((const __m128i *) (y + i)));
+            ad = _mm256_abs_epi16(_mm256_sub_epi16(_mm256_sub_epi16(a, b),
+                                                   vmin));
+            over = _mm256_or_si256(over, _mm256_cmpgt_epi16(ad, vq));
+            ad = _mm256_min_epi16(ad, _mm256_sub_epi16(vq, ad));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(ad, one));
+        }
+        s = _mm_add_epi32(_mm256_castsi256_si128(sum),
+                          _mm256_extracti128_si256(sum, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+        d += _mm_cvtsi128_si32(s);
+    }
+
+    if (!_mm256_testz_si256(over, over))
+        return -1;
+
+    for (; i < n; i++) {
+        int ai = abs(x[i] - y[i] - min);
+        if (ai > q)
+            return -1;
+        d += MIN(ai, q - ai);
+    }
+    return d;
+}
+
+__attribute__ ((target ("sse4.2")))
+static int64_t
+lee_bytes_sse42(const char *x, const char *y, size_t n, int min, int q)
+{
+    const __m128i vmin = _mm_set1_epi16(min);
+    const __m128i vq = _mm_set1_epi16(q);
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i a, b, ad, over = _mm_setzero_si128(), sum;
+    int64_t d = 0;
+    size_t i = 0, e;
+
+    while (i + 8 <= n) {
+        e = i + LEE_BLOCK < n ? i + LEE_BLOCK : n;
+        sum = _mm_setzero_si128();
+        for (; i + 8 <= e; i += 8) {
+            a = LEE_WIDEN128(_mm_loadl_epi64((const __m128i *) (x + i)));
+            b = LEE_WIDEN128(_mm_loadl_epi64((const __m128i *) (y + i)));
+            ad = _mm_abs_epi16(_mm_sub_epi16(_mm_sub_epi16(a, b), vmin));
+            over = _mm_or_si128(over, _mm_cmpgt_epi16(ad, vq));
+            ad = _mm_min_epi16(ad, _mm_sub_epi16(vq, ad));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(ad, one));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+        d += _mm_cvtsi128_si32(sum);
+    }
+
+    if (!_mm_testz_si128(over, over))
+        return -1;
+
+    for (; i < n; i++) {
+        int ai = abs(x[i] - y[i] - min);
+        if (ai > q)
+            return -1;
+        d += MIN(ai, q - ai);
+    }
+    return d;
+}
+#elif SIMD_ARM
+static int64_t
+lee_bytes_neon(const char *x, const char *y, size_t n, int min, int q)
+{
+    const int16x8_t vmin = vdupq_n_s16(min);
+    const int16x8_t vq = vdupq_n_s16(q);
+    uint16x8_t over = vdupq_n_u16(0);
+    int16x8_t a, b, ad;
+    int32x4_t sum;
+    int64_t d = 0;
+    size_t i = 0, e;
+
+    while (i + 8 <= n) {
+        e = i + LEE_BLOCK < n ? i + LEE_BLOCK : n;
+        sum = vdupq_n_s32(0);
+        for (; i + 8 <= e; i += 8) {
+#if CHAR_MIN < 0
+            a = vmovl_s8(vld1_s8((const int8_t *) (x + i)));
+            b = vmovl_s8(vld1_s8((const int8_t *) (y + i)));
+#else
+            a = vreinterpretq_s16_u16(vmovl_u8(vld1_u8((const uint8_t *) (x + i))));
+            b = vreinterpretq_s16_u16(vmovl_u8(vld1_u8((const uint8_t *) (y + i))));
+#endif
+            ad = vabsq_s16(vsubq_s16(vsubq_s16(a, b), vmin));
+            over = vorrq_u16(over, vcgtq_s16(ad, vq));
+            ad = vminq_s16(ad, vsubq_s16(vq, ad));
+            sum = vpadalq_s16(sum, ad);
+        }
+        d += vaddvq_s32(sum);
+    }
+
+    if (vmaxvq_u16(over))
+        return -1;
+
+    for (; i < n; i++) {
+        int ai = abs(x[i] - y[i] - min);
+        if (ai > q)
+            return -1;
+        d += MIN(ai, q - ai);
+    }
+    return d;
+}
+#endif
+
+/**
+ * Computes the Lee distance of the common part of two byte strings with
+ * the kernel for the given level of vector instructions.
+ * @param x first string
+ * @param y second string
+ * @param min smallest symbol
+ * @param q size of alphabet
+ * @param level vector instructions (SIMD_NONE, ...)
+ * @return Lee distance or -1 if no kernel applies
+ */
+static int64_t
+lee_bytes(hstring_t *x, hstring_t *y, int min, int q, int level)
+{
+    size_t n = MIN(x->len, y->len);
+
+    /* Differences need to fit into 16-bit lanes */
+    if (min < 0 || min > 255 || q < 0 || q > 255)
+        return -1;
+
+    switch (level) {
+#if SIMD_X86
+    case SIMD_AVX2:
+        return lee_bytes_avx2(x->str.c, y->str.c, n, min, q);
+    case SIMD_SSE42:
+        return lee_bytes_sse42(x->str.c, y->str.c, n, min, q);
+#elif SIMD_ARM
+    case SIMD_NEON:
+        return lee_bytes_neon(x->str.c, y->str.c, n, min, q);
+#endif
+    default:
+        return -1;
+    }
+}
+
 /**
  * Computes the Lee distance of two strings. If the strings have
  * different lengths, the remaining symbols of the longer string are
@@ -45,10 +229,20 @@ float dist_lee_compare(measures_t *self, hstring_t *x, hstring_t *y)
 {
     measures_opts_t *opts = self->opts;
     float d = 0, ad;
-    int i, q = opts->max_sym - opts->min_sym;
+    int i = 0, q = opts->max_sym - opts->min_sym;
+    int64_t v;
+
+    /* Common part of byte strings */
+    if (x->type == HSTRING_TYPE_BYTE) {
+        v = lee_bytes(x, y, opts->min_sym, q, simd_level());
+        if (v >= 0) {
+            d = v;
+            i = MIN(x->len, y->len);
+        }
+    }
 
     /* Loop over strings */
-    for (i = 0; i < x->len || i < y->len; i++) {
+    for (; i < x->len || i < y->len; i++) {
         if (i < x->len && i < y->len)
             ad = fabs(hstring_compare(x, i, y, i) - opts->min_sym);
         else if (i < x->len)
@@ -125,7 +319,44 @@ dist_lee_test (bool verbose)
         hstring_destroy (&x);
         hstring_destroy (&y);
     }
+
+    //  Compare vector kernels and scalar loop
+    char a[300], b[300];
+    int syms[][2] = {{0, 255}, {0, 127}, {32, 200}};
+    srand (1234);
+
+    for (i = 0; i < 300 && !err; i++) {
+        int j, level, n = rand () % 300, m = rand () % 300;
+        int min = syms[i % 3][0], q = syms[i % 3][1] - min;
+        for (j = 0; j < n; j++)
+            a[j] = 1 + rand () % 255;
+        for (j = 0; j < m; j++)
+            b[j] = 1 + rand () % 255;
+        a[n] = b[m] = 0;
+
+        x = hstring_new (a);
+        y = hstring_new (b);
+
+        int64_t d1 = 0, d2;
+        for (j = 0; j < MIN (n, m) && d1 >= 0; j++) {
+            int ad = abs (a[j] - b[j] - min);
+            d1 = ad > q ? -1 : d1 + MIN (ad, q - ad);
+        }
+
+        for (level = SIMD_NONE + 1; level <= simd_level () && !err; level++) {
+            d2 = lee_bytes (x, y, min, q, level);
+            if (d1 != d2) {
+                printf ("Error %ld != %ld (level %d)\n", (long) d2,
+                        (long) d1, level);
+                err = TRUE;
+            }
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
     measures_destroy (&lee);
+    assert (!err);
     //  @end
 
     printf(" OK\n");
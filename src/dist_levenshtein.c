@@ -46,6 +46,7 @@ dist_levenshtein_config (measures_t *self)
 
 
 
+#ifdef LEVENSHTEIN_COMPARE_YETI
 /**
  * Computes the Levenshtein distance. Code adapted from
  * David Necas (Yeti) <yeti@physics.muni.cz>.
@@ -54,7 +55,7 @@ dist_levenshtein_config (measures_t *self)
  * @return Levenshtein distance
  */
 static float
-dist_levenshtein_compare_yeti(hstring_t *x, hstring_t *y)
+dist_levenshtein_compare_yeti(measures_t *self, hstring_t *x, hstring_t *y)
 {
     int i, *end, half;
     int *row; /* we only need to keep one row of costs */
@@ -87,7 +88,7 @@ dist_levenshtein_compare_yeti(hstring_t *x, hstring_t *y)
     half = x->len >> 1;
 
     /* Unitalize first row */
-    row = (int *) zmalloc ((y->len) * sizeof (int));
+    row = (int *) measures_alloc (self, (y->len) * sizeof (int));
     if (!row) {
         error("Failed to allocate memory for Levenshtein distance");
         return 0;
@@ -157,52 +158,331 @@ dist_levenshtein_compare_yeti(hstring_t *x, hstring_t *y)
     y->len--;
 
     i = *end;
-    free(row);
+    measures_release(self, row);
     return i;
 }
+#endif
+
+/*
+ * Bit-parallel computation of the Levenshtein distance for unit costs.
+ *
+ * G. Myers. A fast bit-vector algorithm for approximate string matching
+ * based on dynamic programming. Journal of the ACM, 46(3):395-415, 1999.
+ * H. Hyyrö. A bit-vector algorithm for computing Levenshtein and Damerau
+ * edit distances. Nordic Journal of Computing, 10(1):29-39, 2003.
+ *
+ * The shorter string is encoded as match vectors (Peq) of 64-bit words.
+ * Strings with up to 64 symbols are processed with a single word per
+ * column, longer strings with a blocked variant that passes horizontal
+ * deltas between consecutive words.
+ */
+
+/* Size of stack buffer for match vectors (fits one word per symbol) */
+#define PEQ_STACK	512
+
+/**
+ * Table of match vectors for the pattern string
+ */
+typedef struct
+{
+    int words;                /**< Number of 64-bit words per vector */
+    int slots;                /**< Slots of token table (power of 2) */
+    int shift;                /**< Shift for hashing tokens into slots */
+    uint64_t *vecs;           /**< Match vectors */
+    sym_t *keys;              /**< Token keys */
+    unsigned char *used;      /**< Used slots of token table */
+    uint64_t *none;           /**< Vector of zeros for unknown tokens */
+} peq_t;
+
+/**
+ * Returns the slot of a token in the table of match vectors.
+ * @param p Table of match vectors
+ * @param s Symbol of token
+ * @return slot index
+ */
+static inline int
+peq_slot (peq_t *p, sym_t s)
+{
+    int k = (int) ((s * 0x9e3779b97f4a7c15ULL) >> p->shift);
+    while (p->used[k] && p->keys[k] != s)
+        k = (k + 1) & (p->slots - 1);
+    return k;
+}
+
+/**
+ * Returns the match vector for symbol j of a string
+ * @param p Table of match vectors
+ * @param y String
+ * @param j Position in string
+ * @return match vector
+ */
+static inline uint64_t *
+peq_get (peq_t *p, hstring_t *y, int j)
+{
+    int k;
+
+    switch (y->type) {
+    case HSTRING_TYPE_BYTE:
+        return p->vecs + (unsigned char) y->str.c[j] * p->words;
+    case HSTRING_TYPE_BIT:
+        return p->vecs + hstring_get (y, j) * p->words;
+    case HSTRING_TYPE_TOKEN:
+        k = peq_slot (p, y->str.s[j]);
+        return p->used[k] ? p->vecs + k * p->words : p->none;
+    default:
+        error("Unknown string type");
+        return p->none;
+    }
+}
+
+/**
+ * Returns the size of a table of match vectors in 64-bit words
+ * @param p Table of match vectors (words set)
+ * @param x Pattern string
+ * @return size in words
+ */
+static size_t
+peq_size (peq_t *p, hstring_t *x)
+{
+    size_t rows;
+
+    p->slots = 0;
+    p->shift = 64;
+    if (x->type == HSTRING_TYPE_TOKEN) {
+        for (p->slots = 1; p->slots < 2 * x->len; p->slots <<= 1)
+            p->shift--;
+        rows = p->slots + 1;
+        /* Keys and flags of slots */
+        return rows * p->words + p->slots + (p->slots + 7) / 8;
+    }
+
+    rows = x->type == HSTRING_TYPE_BIT ? 2 : 256;
+    return rows * p->words;
+}
+
+/**
+ * Fills a table of match vectors for a pattern string
+ * @param p Table of match vectors (size set)
+ * @param x Pattern string
+ * @param buf Zeroed buffer of peq_size() words
+ */
+static void
+peq_init (peq_t *p, hstring_t *x, uint64_t *buf)
+{
+    int i, k;
+    uint64_t *v;
+
+    p->vecs = buf;
+    p->none = NULL;
+    p->keys = NULL;
+    p->used = NULL;
+    if (x->type == HSTRING_TYPE_TOKEN) {
+        p->none = buf + p->slots * p->words;
+        p->keys = (sym_t *) (p->none + p->words);
+        p->used = (unsigned char *) (p->keys + p->slots);
+    }
+
+    for (i = 0; i < x->len; i++) {
+        if (x->type == HSTRING_TYPE_TOKEN) {
+            k = peq_slot (p, x->str.s[i]);
+            p->keys[k] = x->str.s[i];
+            p->used[k] = 1;
+            v = p->vecs + k * p->words;
+        } else {
+            v = peq_get (p, x, i);
+        }
+        v[i / 64] |= 1ULL << (i % 64);
+    }
+}
+
+/**
+ * Computes the Levenshtein distance with unit costs using the
+ * bit-parallel algorithm by Myers and Hyyrö. The computation stops
+ * early once the distance is known to exceed the bound k. In this case
+ * a lower bound larger than k is returned.
+ * @param x first string
+ * @param y second string
+ * @param k bound on distance (INFINITY for none)
+ * @return Levenshtein distance
+ */
+static float
+dist_levenshtein_compare_myers (measures_t *self, hstring_t *x, hstring_t *y,
+                                double k)
+{
+    uint64_t stack[PEQ_STACK], *buf, *vp, *vn, last;
+    uint64_t eq, xv, xh, ph, mh;
+    int i, j, score, hin, hout;
+    size_t size;
+    peq_t peq;
+
+    /* Make the pattern (i.e. x) the shorter one */
+    if (x->len > y->len) {
+        hstring_t *z = x;
+        x = y;
+        y = z;
+    }
+
+    /* Catch trivial case and strings differing too much in length */
+    if (x->len == 0 || y->len - x->len > k)
+        return y->len - x->len;
+
+    peq.words = (x->len + 63) / 64;
+    size = peq_size (&peq, x) + 2 * peq.words;
+    if (size <= PEQ_STACK) {
+        buf = stack;
+        memset (buf, 0, size * sizeof (uint64_t));
+    } else {
+        buf = measures_alloc (self, size * sizeof (uint64_t));
+        if (!buf) {
+            error("Failed to allocate memory for Levenshtein distance");
+            return 0;
+        }
+        memset (buf, 0, size * sizeof (uint64_t));
+    }
+
+    peq_init (&peq, x, buf);
+    vp = buf + size - 2 * peq.words;
+    vn = vp + peq.words;
+    for (i = 0; i < peq.words; i++)
+        vp[i] = ~0ULL;
+
+    score = x->len;
+    last = 1ULL << ((x->len - 1) % 64);
+
+    if (peq.words == 1) {
+        /* Single word per column */
+        uint64_t pv = vp[0], mv = 0;
+        for (j = 0; j < y->len; j++) {
+            eq = *peq_get (&peq, y, j);
+            xv = eq | mv;
+            xh = (((eq & pv) + pv) ^ pv) | eq;
+            ph = mv | ~(xh | pv);
+            mh = pv & xh;
+            if (ph & last)
+                score++;
+            else if (mh & last)
+                score--;
+            ph = (ph << 1) | 1;
+            mh = mh << 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+            /* The last row decreases by at most one per column */
+            if (score - (y->len - j - 1) > k) {
+                score -= y->len - j - 1;
+                break;
+            }
+        }
+    } else {
+        /* Blocks of words per column */
+        for (j = 0; j < y->len; j++) {
+            uint64_t *col = peq_get (&peq, y, j);
+            /* Top row of the matrix increases by one */
+            hin = 1;
+            for (i = 0; i < peq.words; i++) {
+                uint64_t high = i < peq.words - 1 ? 1ULL << 63 : last;
+                eq = col[i];
+                xv = eq | vn[i];
+                if (hin < 0)
+                    eq |= 1;
+                xh = (((eq & vp[i]) + vp[i]) ^ vp[i]) | eq;
+                ph = vn[i] | ~(xh | vp[i]);
+                mh = vp[i] & xh;
+                hout = (ph & high) ? 1 : ((mh & high) ? -1 : 0);
+                ph <<= 1;
+                mh <<= 1;
+                if (hin < 0)
+                    mh |= 1;
+                else if (hin > 0)
+                    ph |= 1;
+                vp[i] = mh | ~(xv | ph);
+                vn[i] = ph & xv;
+                hin = hout;
+            }
+            score += hin;
+            if (score - (y->len - j - 1) > k) {
+                score -= y->len - j - 1;
+                break;
+            }
+        }
+    }
+
+    if (buf != stack)
+        measures_release (self, buf);
+
+    return score;
+}
 
 /* Ugly macros to access arrays */
 #define ROWS(i,j)	rows[(i) * (y->len + 1) + (j)]
 
+/**
+ * Minimum cost of an insertion or deletion. The margins of the matrix
+ * are counted with unit costs.
+ * @param opts Options of measure
+ * @return minimum cost
+ */
+static inline double
+toub_cost (measures_opts_t *opts)
+{
+    return fmin(fmin(opts->cost_ins, opts->cost_del), 1.0);
+}
+
 /**
  * Computes the Levenshtein distance of two strings.
  * Adapted from Stephen Toub's C# implementation.
  * http://blogs.msdn.com/b/toub/archive/2006/05/05/590814.aspx
+ * Only the band of diagonals that can stay within the bound on the
+ * distance is computed and the computation stops early if all cells of
+ * a row exceed the bound, as the costs are non-negative. Distances
+ * beyond the bound are returned as some value larger than the bound.
  * @param x first string
  * @param y second string
+ * @param k bound on distance (INFINITY for none)
+ * @param type string type
  * @return Levenshtein distance
  */
-static float
-dist_levenshtein_compare_toub (measures_t *self, hstring_t *x, hstring_t *y)
+HSTRING_INLINE float
+dist_levenshtein_compare_toub (measures_t *self, hstring_t *x, hstring_t *y,
+                               double k, const unsigned int type)
 {
     measures_opts_t *opts = self->opts;
-    int i, j;
-    double a, b;
+    int i, j, lo, hi, jlo, jhi;
+    double a, b, min, c = toub_cost(opts);
 
     if (x->len == 0 && y->len == 0)
         return 0;
 
+    if (!measures_band(x->len, y->len, k, c, &lo, &hi))
+        return c * abs(y->len - x->len);
+
     /*
      * Rather than maintain an entire matrix (which would require O(n*m)
      * space), just store the current row and the next row, each of which
      * has a length m+1, so just O(m) space.  Initialize the curr row.
      */
     int curr = 0, next = 1;
-    double *rows = (double *) zmalloc(sizeof(double) * (y->len + 1) * 2);
+    double *rows = (double *) measures_alloc(self, sizeof(double) * (y->len + 1) * 2);
     if (!rows) {
         error("Failed to allocate memory for Levenshtein distance");
         return 0;
     }
 
     for (j = 0; j <= y->len; j++)
-         ROWS(curr,j) = j;
+         ROWS(curr,j) = j <= hi ? j : INFINITY;
 
     /* For each virtual row (we only have physical storage for two) */
     for (i = 1; i <= x->len; i++) {
+        jlo = i + lo > 0 ? i + lo : 0;
+        jhi = i + hi < y->len ? i + hi : y->len;
 
-        /* Fill in the values in the row */
+        /* Cells left of the band are unreachable */
         ROWS(next,0) = i;
-        for (j = 1; j <= y->len; j++) {
+        if (jlo > 1)
+            ROWS(next, jlo - 1) = INFINITY;
+        min = jlo == 0 ? i : INFINITY;
+
+        /* Fill in the values of the band */
+        for (j = jlo > 1 ? jlo : 1; j <= jhi; j++) {
 
             /* Insertion and deletion */
             a = ROWS(curr,j) + opts->cost_ins;
@@ -212,7 +492,7 @@ dist_levenshtein_compare_toub (measures_t *self, hstring_t *x, hstring_t *y)
 
             /* Substitution */
             b = ROWS(curr, j - 1) +
-                (hstring_compare(x, i - 1, y, j - 1) ? opts->cost_sub : 0);
+                (hstring_equal(x, i - 1, y, j - 1, type) ? 0 : opts->cost_sub);
 
             if (a > b)
                 a = b;
@@ -223,8 +503,14 @@ dist_levenshtein_compare_toub (measures_t *self, hstring_t *x, hstring_t *y)
              * are available. Potential fix: provide three rows.
              */
             ROWS(next, j) = a;
+            if (a < min)
+                min = a;
         }
 
+        /* Cells right of the band are unreachable */
+        if (jhi < y->len)
+            ROWS(next, jhi + 1) = INFINITY;
+
         /* Swap the current and next rows */
         if (curr == 0) {
             curr = 1;
@@ -233,15 +519,52 @@ dist_levenshtein_compare_toub (measures_t *self, hstring_t *x, hstring_t *y)
             curr = 0;
             next = 1;
         }
+
+        /* Every path to the last cell crosses this row */
+        if (min > k) {
+            measures_release(self, rows);
+            return min;
+        }
     }
     double d = ROWS(curr, y->len);
 
     /* Free memory */
-    free(rows);
+    measures_release(self, rows);
 
     return d;
 }
 
+/**
+ * Computes the Levenshtein distance with arbitrary costs in a band of
+ * diagonals. Without a bound the band is doubled until the distance
+ * lies within (Ukkonen), such that the run-time is O(d * n) for a
+ * distance d.
+ * @param x first string
+ * @param y second string
+ * @param k bound on distance (INFINITY for none)
+ * @param type string type
+ * @return Levenshtein distance
+ */
+HSTRING_INLINE float
+dist_levenshtein_compare_band (measures_t *self, hstring_t *x, hstring_t *y,
+                               double k, const unsigned int type)
+{
+    double c = toub_cost(self->opts);
+    double b = c * (abs(y->len - x->len) + MEASURES_BAND);
+    float f;
+
+    if (k < INFINITY)
+        return dist_levenshtein_compare_toub(self, x, y, k, type);
+
+    for (;; b *= 2) {
+        if (b >= c * (x->len + y->len))
+            return dist_levenshtein_compare_toub(self, x, y, INFINITY, type);
+        f = dist_levenshtein_compare_toub(self, x, y, b, type);
+        if (f <= b)
+            return f;
+    }
+}
+
 
 /**
  * Computes the Levenshtein distance. Wrapper function.
@@ -256,16 +579,25 @@ dist_levenshtein_compare (measures_t *self, hstring_t *x, hstring_t *y)
     float f;
     measures_opts_t *opts = self->opts;
 
+    /* Normalized distances are filtered afterwards only */
+    double k = opts->lnorm == LN_NONE ? opts->max_dist : INFINITY;
+
     /*
      * If the costs of all edit operations are equal we use the fast
-     * implementation by David Necas, otherwise we switch to the
+     * bit-parallel implementation, otherwise we switch to the
      * variant by Stephen Toub.
      */
     if (fabs (opts->cost_ins - opts->cost_del) < 1e-6
      && fabs (opts->cost_del - opts->cost_sub) < 1e-6) {
-        f = opts->cost_ins * dist_levenshtein_compare_yeti (x, y);
+#ifdef LEVENSHTEIN_COMPARE_YETI
+        f = opts->cost_ins * dist_levenshtein_compare_yeti (self, x, y);
+#else
+        f = opts->cost_ins *
+            dist_levenshtein_compare_myers (self, x, y, k / opts->cost_ins);
+#endif
     } else {
-        f = dist_levenshtein_compare_toub (self, x, y);
+        HSTRING_SPECIALIZE (f, x->type, dist_levenshtein_compare_band,
+                            self, x, y, k);
     }
 
     if (opts->lnorm == LN_NONE)
@@ -363,6 +695,17 @@ static struct hstring_test tests[] = {
     {"Web Aplications", "WebRAD: Building Database Applications on the Web with Visual FoxPro and Web Connection", "", 72},
     {"Web Aplications", "Structural Assessment: The Role of Large and Full-Scale Testing", "", 56},
     {"Web Aplications", "How to Find a Scholarship Online", "", 26},
+    /* Strings exceeding a single machine word */
+    {"Web Database Applications with PHP & MySQL and lots of other stuff",
+     "Web Database Applications with PHP & MySQL and lots of other stuff", "", 0},
+    {"Web Database Applications with PHP & MySQL and lots of other stuff",
+     "web Database Applications with PHP & MySQL and lots of other stuff!", "", 2},
+    {"WebRAD: Building Database Applications on the Web with Visual FoxPro and Web Connection",
+     "Building Web Database Applications with Visual Studio 6", "", 46},
+    {"a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z",
+     "a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z", ".", 0},
+    {"a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z",
+     "b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.y", ".", 2},
     {NULL}
 };
 
@@ -470,6 +813,54 @@ dist_levenshtein_test (bool verbose)
         hstring_destroy (&y);
     }
 
+    //  Compare bit-parallel and dynamic programming variants
+    char a[300], b[300];
+    const char *gran[] = {"bytes", "tokens", "bits"};
+    hstring_delim_set (".");
+    srand (1234);
+
+    for (i = 0; i < 600 && !err; i++) {
+        int j, n = rand () % 300, m = rand () % 300;
+        for (j = 0; j < n; j++)
+            a[j] = '.' + rand () % 4;
+        for (j = 0; j < m; j++)
+            b[j] = '.' + rand () % 4;
+        a[n] = b[m] = 0;
+
+        measures_config_set_string (levenshtein, "measures.granularity",
+                                    gran[i % 3]);
+
+        x = hstring_new (a);
+        y = hstring_new (b);
+        hstring_preproc (x, levenshtein);
+        hstring_preproc (y, levenshtein);
+
+        float d1 = dist_levenshtein_compare_myers (levenshtein, x, y, INFINITY);
+        float d2 = dist_levenshtein_compare_toub (levenshtein, x, y, INFINITY,
+                                                  x->type);
+        float d3 = dist_levenshtein_compare_band (levenshtein, x, y, INFINITY,
+                                                  x->type);
+
+        if (fabs (d1 - d2) > 1e-6 || fabs (d1 - d3) > 1e-6) {
+            printf ("Error %f != %f (%d, %d)\n", d1, d2, n, m);
+            err = TRUE;
+        }
+
+        //  Bounded variants are exact below and exceed the bound above
+        double k = rand () % 200;
+        float b1 = dist_levenshtein_compare_myers (levenshtein, x, y, k);
+        float b2 = dist_levenshtein_compare_toub (levenshtein, x, y, k,
+                                                  x->type);
+        if ((d1 <= k && (b1 != d1 || b2 != d1)) ||
+            (d1 > k && (b1 <= k || b2 <= k || b1 > d1))) {
+            printf ("Error %f, %f != %f (bound %f)\n", b1, b2, d1, k);
+            err = TRUE;
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
+
     //  Cleanup
     measures_destroy (&levenshtein);
     measures_destroy (&wlevenshtein);
@@ -41,69 +41,167 @@ void dist_osa_config(measures_t *self)
     opts->lnorm = lnorm_get(str);
 }
 
-/* Ugly macros to access arrays */
-#define D(i,j) 		d[(i) * (y->len + 1) + (j)]
+/* Value of unreachable cells */
+#define OSA_INF     (INT_MAX / 2)
 
 /**
- * Computes the OSA distance of two strings.
+ * Minimum cost of an insertion or deletion. Costs are truncated when
+ * added to the integer cells of the matrix.
+ * @param opts Options of measure
+ * @return minimum cost
+ */
+static inline double
+osa_cost(measures_opts_t *opts)
+{
+    return floor(fmin(opts->cost_ins, opts->cost_del));
+}
+
+/**
+ * Computes the OSA distance of two strings for a given string type.
+ * Only the band of diagonals that can stay within the bound k is
+ * computed, keeping three rows of the matrix. The computation stops
+ * early if two consecutive rows exceed the bound, as every path to the
+ * last cell crosses one of them.
  * @param x first string
  * @param y second string
- * @return OSA distance
+ * @param k bound on distance (INFINITY for none)
+ * @param type string type
+ * @return OSA distance or value larger than k
  */
-float dist_osa_compare(measures_t *self, hstring_t *x, hstring_t *y)
+HSTRING_INLINE double
+osa(measures_t *self, hstring_t *x, hstring_t *y, double k,
+    const unsigned int type)
 {
     measures_opts_t *opts = self->opts;
-    int i, j, a, b, c;
+    int i, j, a, b, c, min, last = 0, lo, hi, jlo, jhi;
+    double cost = osa_cost(opts);
 
-    if (x->len == 0 && y->len == 0)
-        return 0;
+    if (!measures_band(x->len, y->len, k, cost, &lo, &hi))
+        return cost * abs(y->len - x->len);
 
-    /* Allocate matrix. We might reduce this to some rows only */
-    int *d = (int *) calloc((x->len + 1) * (y->len + 1), sizeof(int));
+    /* Three rows of the matrix: i - 2, i - 1 and i */
+    int *buf = (int *) measures_alloc(self, 3 * (y->len + 1) * sizeof(int));
+    if (!buf) {
+        error("Could not allocate memory for OSA distance");
+        return 0;
+    }
+    int *r0 = buf, *r1 = buf + y->len + 1, *r2 = r1 + y->len + 1, *t;
 
     /* Init margin of matrix */
-    for (i = 0; i <= x->len; i++)
-        D(i, 0) = i * opts->cost_ins;
     for (j = 0; j <= y->len; j++)
-        D(0, j) = j * opts->cost_ins;
+        r1[j] = j <= hi ? j * opts->cost_ins : OSA_INF;
 
     for (i = 1; i <= x->len; i++) {
-        for (j = 1; j <= y->len; j++) {
+        jlo = i + lo > 0 ? i + lo : 0;
+        jhi = i + hi < y->len ? i + hi : y->len;
+
+        /* Cells left of the band are unreachable */
+        r2[0] = i * opts->cost_ins;
+        if (jlo > 1)
+            r2[jlo - 1] = OSA_INF;
+        min = jlo == 0 ? r2[0] : OSA_INF;
+
+        for (j = jlo > 1 ? jlo : 1; j <= jhi; j++) {
 
             /* Comparison */
-            c = hstring_compare(x, i - 1, y, j - 1);
+            c = !hstring_equal(x, i - 1, y, j - 1, type);
 
             /* Insertion an deletion */
-            a = D(i - 1, j) + opts->cost_ins;
-            b = D(i, j - 1) + opts->cost_del;
+            a = r1[j] + opts->cost_ins;
+            b = r2[j - 1] + opts->cost_del;
             if (a > b)
                 a = b;
 
             /* Substitution */
-            b = D(i - 1, j - 1) + (c ? opts->cost_sub : 0);
+            b = r1[j - 1] + (c ? opts->cost_sub : 0);
             if (a > b)
                 a = b;
 
             /* Transposition */
             if (i > 1 && j > 1 &&
-                !hstring_compare(x, i - 1, y, j - 2) &&
-                !hstring_compare(x, i - 2, y, j - 1)) {
-                b = D(i - 2, j - 2) + (c ? opts->cost_tra : 0);
+                hstring_equal(x, i - 1, y, j - 2, type) &&
+                hstring_equal(x, i - 2, y, j - 1, type)) {
+                b = r0[j - 2] + (c ? opts->cost_tra : 0);
                 if (a > b)
                     a = b;
             }
 
             /* Update matrix */
-            D(i, j) = a;
+            r2[j] = a;
+            if (a < min)
+                min = a;
         }
+
+        /* Cells right of the band are unreachable */
+        if (jhi < y->len)
+            r2[jhi + 1] = OSA_INF;
+
+        /* Transpositions skip at most one row */
+        if (min > k && last > k) {
+            measures_release(self, buf);
+            return fmin(min, last);
+        }
+        last = min;
+
+        /* Rotate rows */
+        t = r0, r0 = r1, r1 = r2, r2 = t;
     }
 
-    double m = D(x->len, y->len);
-    free(d);
+    double m = r1[y->len];
+    measures_release(self, buf);
 
-    return lnorm(opts->lnorm, m, x, y);
+    return m;
+}
+
+/**
+ * Computes the OSA distance in a band of diagonals. Without a bound the
+ * band is doubled until the distance lies within (Ukkonen), such that the
+ * run-time is O(d * n) for a distance d and the memory linear.
+ * @param x first string
+ * @param y second string
+ * @param k bound on distance (INFINITY for none)
+ * @param type string type
+ * @return OSA distance or value larger than k
+ */
+HSTRING_INLINE double
+osa_band(measures_t *self, hstring_t *x, hstring_t *y, double k,
+         const unsigned int type)
+{
+    double c = osa_cost(self->opts);
+    double b = c * (abs(y->len - x->len) + MEASURES_BAND), m;
+
+    if (k < INFINITY)
+        return osa(self, x, y, k, type);
+
+    for (;; b *= 2) {
+        if (b >= c * (x->len + y->len))
+            return osa(self, x, y, INFINITY, type);
+        m = osa(self, x, y, b, type);
+        if (m <= b)
+            return m;
+    }
 }
 
+/**
+ * Computes the OSA distance of two strings.
+ * @param x first string
+ * @param y second string
+ * @return OSA distance
+ */
+float dist_osa_compare(measures_t *self, hstring_t *x, hstring_t *y)
+{
+    measures_opts_t *opts = self->opts;
+    double m;
+
+    if (x->len == 0 && y->len == 0)
+        return 0;
+
+    /* Normalized distances are filtered afterwards only */
+    double k = opts->lnorm == LN_NONE ? opts->max_dist : INFINITY;
+    HSTRING_SPECIALIZE(m, x->type, osa_band, self, x, y, k);
+
+    return lnorm(opts->lnorm, m, x, y);
+}
 
 //  --------------------------------------------------------------------------
 //  Self test of this class
@@ -128,6 +226,15 @@ static struct hstring_test tests[] = {
     {NULL}
 };
 
+/*
+ * Without bound the band covers the full matrix
+ */
+static double
+osa_full(measures_t *self, hstring_t *x, hstring_t *y)
+{
+    return osa(self, x, y, INFINITY, HSTRING_TYPE_BYTE);
+}
+
 void
 dist_osa_test (bool verbose)
 {
@@ -159,7 +266,37 @@ dist_osa_test (bool verbose)
         hstring_destroy(&x);
         hstring_destroy(&y);
     }
+
+    /* Banded variants match the full matrix */
+    char a[200], b[200];
+    srand(4321);
+    for (i = 0; i < 300 && !err; i++) {
+        int j, n = rand() % 200, m = n / 2 + rand() % (n / 2 + 1);
+        for (j = 0; j < n; j++)
+            a[j] = b[j] = 'a' + rand() % 4;
+        for (j = 0; j < n / 8; j++)
+            b[rand() % n] = 'a' + rand() % 4;
+        a[n] = b[m] = 0;
+
+        x = hstring_new(a);
+        y = hstring_new(b);
+        hstring_preproc(x, osa);
+        hstring_preproc(y, osa);
+
+        double d = osa_full(osa, x, y);
+        double e = osa_band(osa, x, y, INFINITY, HSTRING_TYPE_BYTE);
+        double k = rand() % 100;
+        double f = osa_band(osa, x, y, k, HSTRING_TYPE_BYTE);
+        if (d != e || (d <= k ? f != d : f <= k)) {
+            printf("Error %f, %f, %f (bound %f)\n", d, e, f, k);
+            err = TRUE;
+        }
+
+        hstring_destroy(&x);
+        hstring_destroy(&y);
+    }
     measures_destroy (&osa);
+    assert (!err);
     //  @end
 
     printf(" OK\n");
@@ -30,7 +30,7 @@ static char *measure = NULL;
 static int benchmark = 0;
 
 /* Option string */
-#define OPTSTRING "i:o:p:zm:g:d:n:a:Gx:y:s:c:vlqMCDVh"
+#define OPTSTRING "i:o:p:zm:g:d:n:a:Gx:y:s:k:c:vlqMCDVh"
 
 
 /**
@@ -43,6 +43,7 @@ static struct option longopts[] = {
     {"stoptoken_file", 1, NULL, 1002},
     {"soundex", 0, NULL, 1003},
     {"benchmark", 1, NULL, 1004},
+    {"update", 1, NULL, 1010},
     {"output_format", 1, NULL, 'o'},
     {"precision", 1, NULL, 'p'},
     {"compress", 0, NULL, 'z'},
@@ -55,9 +56,18 @@ static struct option longopts[] = {
     {"num_threads", 1, NULL, 'n'},
     {"cache_size", 1, NULL, 'a'},
     {"global_cache", 0, NULL, 'G'},
+    {"cache_file", 1, NULL, 1008},
+    {"cache_readonly", 0, NULL, 1009},
     {"col_range", 1, NULL, 'x'},
     {"row_range", 1, NULL, 'y'},
     {"split", 1, NULL, 's'},
+    {"matrix_file", 1, NULL, 1011},
+    {"top_k", 1, NULL, 'k'},
+    {"max_distance", 1, NULL, 1012},
+    {"min_similarity", 1, NULL, 1013},
+    {"prefilter", 1, NULL, 1014},
+    {"sketch", 1, NULL, 1015},
+    {"lsh", 1, NULL, 1016},
     {"config_file", 1, NULL, 'c'},
     {"verbose", 0, NULL, 'v'},
     {"log_line", 0, NULL, 'l'},
@@ -118,6 +128,7 @@ static void print_usage(void)
            "       --stoptoken_file <file>   Provide a file with stop tokens.\n"
            "       --soundex                 Enable soundex encoding of tokens.\n"
            "       --benchmark <num>         Perform benchmark for given seconds.\n"
+           "       --update <file>           Update matrix in raw format of previous run.\n"
            "  -o,  --output_format <format>  Set output format for matrix.\n"
            "  -p,  --precision <num>         Set precision of output.\n"
            "  -z,  --compress                Enable zlib compression of output.\n"
@@ -131,9 +142,18 @@ static void print_usage(void)
            "  -n,  --num_threads <num>       Set number of threads.\n"
            "  -a,  --cache_size <num>        Set size of cache in megabytes.\n"
            "  -G,  --global_cache            Enable global cache.\n"
+           "       --cache_file <file>       Set file of persistent cache.\n"
+           "       --cache_readonly          Open persistent cache read-only.\n"
            "  -x,  --col_range <start:end>   Set the column range (x) of strings.\n"
            "  -y,  --row_range <start:end>   Set the row range (y) of strings.\n"
            "  -s,  --split <blocks:id>       Split matrix into blocks and compute one.\n"
+           "       --matrix_file <file>      Store matrix in memory-mapped file.\n"
+           "  -k,  --top_k <num>             Keep only the k most similar strings per row.\n"
+           "       --max_distance <num>      Keep only distances up to num.\n"
+           "       --min_similarity <num>    Keep only similarities from num.\n"
+           "       --prefilter <num>         Prefilter edit distances beyond num.\n"
+           "       --sketch <num>            Estimate coefficients from sketches of num bins.\n"
+           "       --lsh <bands:rows>        Compare only candidate pairs of LSH bands.\n"
            "\nGeneric options:\n"
            "  -c,  --config_file <file>      Set configuration file.\n"
            "  -v,  --verbose                 Increase verbosity.\n"
@@ -205,6 +225,18 @@ static void harry_parse_options(int argc, char **argv, char **in1,
         case 1007:
             config_set_bool(&cfg, "output.save_sources", CONFIG_TRUE);
             break;
+        case 1008:
+            config_set_string(&cfg, "measures.cache_file", optarg);
+            break;
+        case 1009:
+            config_set_bool(&cfg, "measures.cache_readonly", CONFIG_TRUE);
+            break;
+        case 1010:
+            config_set_string(&cfg, "input.update_file", optarg);
+            break;
+        case 1011:
+            config_set_string(&cfg, "measures.matrix_file", optarg);
+            break;
         case 'o':
             config_set_string(&cfg, "output.output_format", optarg);
             break;
@@ -226,6 +258,24 @@ static void harry_parse_options(int argc, char **argv, char **in1,
         case 'G':
             config_set_bool(&cfg, "measures.global_cache", CONFIG_TRUE);
             break;
+        case 'k':
+            config_set_int(&cfg, "measures.top_k", atoi(optarg));
+            break;
+        case 1012:
+            config_set_float(&cfg, "measures.max_distance", atof(optarg));
+            break;
+        case 1013:
+            config_set_float(&cfg, "measures.min_similarity", atof(optarg));
+            break;
+        case 1014:
+            config_set_float(&cfg, "measures.prefilter", atof(optarg));
+            break;
+        case 1015:
+            config_set_int(&cfg, "measures.sim_coefficient.sketch", atoi(optarg));
+            break;
+        case 1016:
+            config_set_string(&cfg, "measures.lsh", optarg);
+            break;
         case 'g':
             config_set_string(&cfg, "measures.granularity", optarg);
             break;
@@ -442,6 +492,7 @@ static hstring_t *harry_read(char *input, char *input2, int *num)
         strs = realloc(strs, (*num + chunk) * sizeof(hstring_t));
         if (!strs)
             fatal("Could not allocate memory for strings");
+        memset(strs + *num, 0, chunk * sizeof(hstring_t));
 
         /* Read chunk */
         read = input_read(strs + *num, chunk);
@@ -463,6 +514,7 @@ static hstring_t *harry_read(char *input, char *input2, int *num)
             strs = realloc(strs, (*num + chunk) * sizeof(hstring_t));
             if (!strs)
                 fatal("Could not allocate memory for strings");
+            memset(strs + *num, 0, chunk * sizeof(hstring_t));
 
             /* Read chunk */
             read = input_read(strs + *num, chunk);
@@ -500,7 +552,8 @@ void harry_compute(hmatrix_t *mat, hstring_t *strs, int num)
 #else
     info_msg(1, "Computing similarity measure '%s'", measure);
 #endif
-    hmatrix_compute(mat, strs, measure_compare);
+    if (!hmatrix_compute(mat, strs, measure_compare))
+        fatal("Could not compute similarity measure");
 }
 
 
@@ -536,7 +589,11 @@ void harry_benchmark(hmatrix_t *mat, hstring_t *strs, int num)
 static hmatrix_t *harry_alloc(hstring_t *strs, int num)
 {
     char *cfg_str;
-    int i;
+    cfg_int top_k;
+    double cutoff;
+    const char *lsh;
+    cfg_int qgram;
+    int i, bands = 0, rows = 0, dist = !strncasecmp(measure, "dist_", 5);
 
     hmatrix_t *mat = hmatrix_init(strs, num);
 
@@ -558,9 +615,46 @@ static hmatrix_t *harry_alloc(hstring_t *strs, int num)
             hstring_destroy(&strs[i]);
     }
 
-    /* Allocate matrix */
-    if (!hmatrix_alloc(mat))
+    /* Keep sparse rows, allocate matrix in memory or map it from a file */
+    config_lookup_int(&cfg, "measures.top_k", &top_k);
+    config_lookup_string(&cfg, "measures.matrix_file", (const char **) &cfg_str);
+    if (top_k > 0) {
+        /* Distances are similar if small, all others if large */
+        if (!hmatrix_top_k(mat, top_k, !dist))
+            fatal("Could not allocate sparse matrix for similarity measure");
+    }
+
+    /* Keep only values within cutoff (negative disables it) */
+    config_lookup_float(&cfg, dist ? "measures.max_distance" :
+                        "measures.min_similarity", &cutoff);
+    if (cutoff >= 0) {
+        if (!hmatrix_cutoff(mat, cutoff, !dist))
+            fatal("Could not allocate sparse matrix for similarity measure");
+    }
+
+    /* Compare only candidate pairs of LSH */
+    config_lookup_string(&cfg, "measures.lsh", &lsh);
+    config_lookup_int(&cfg, "measures.lsh_qgram", &qgram);
+    if (strlen(lsh) > 0) {
+        if (sscanf(lsh, "%d:%d", &bands, &rows) != 2)
+            fatal("Invalid bands of LSH '%s'", lsh);
+        if (!hmatrix_lsh(mat, bands, rows, qgram, !dist))
+            fatal("Could not allocate sparse matrix for similarity measure");
+    }
+
+    if (mat->rows) {
+        /* Sparse rows are allocated already */
+    } else if (strlen(cfg_str) > 0) {
+        if (!hmatrix_map(mat, cfg_str))
+            fatal("Could not map matrix for similarity measure");
+    } else if (!hmatrix_alloc(mat)) {
         fatal("Could not allocate matrix for similarity measure");
+    }
+
+    /* Load values of previous matrix */
+    config_lookup_string(&cfg, "input.update_file", (const char **) &cfg_str);
+    if (strlen(cfg_str) > 0 && hmatrix_load(mat, cfg_str) < 0)
+        fatal("Could not load matrix for update");
 
     return mat;
 }
@@ -577,6 +671,12 @@ static void harry_write(char *output, hmatrix_t *mat)
 
     /* Open output */
     config_lookup_string(&cfg, "output.output_format", &cfg_str);
+    if (mat->rows && strcasecmp(cfg_str, "triples") &&
+        strcasecmp(cfg_str, "coo") && strcasecmp(cfg_str, "csr") &&
+        strcasecmp(cfg_str, "null")) {
+        warning("Sparse matrix requires sparse output. Using 'triples'.");
+        cfg_str = "triples";
+    }
     output_config(cfg_str);
     info_msg(1, "Writing %ld similarity values to '%0.40s' [%s].",
              mat->size, output, cfg_str);
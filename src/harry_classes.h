@@ -29,6 +29,7 @@
 #include "hconfig.h"
 #include "vcache.h"
 #include "hmatrix.h"
+#include "hist.h"
 #include "kern_distance.h"
 #include "kern_subsequence.h"
 #include "kern_spectrum.h"
@@ -77,6 +78,11 @@ HARRY_PRIVATE void
 HARRY_PRIVATE void
     hmatrix_test (bool verbose);
 
+//  *** Draft method, defined for internal use only ***
+//  Self test of this class.
+HARRY_PRIVATE void
+    hist_test (bool verbose);
+
 //  *** Draft method, defined for internal use only ***
 //  Self test of this class.
 HARRY_PRIVATE void
@@ -34,6 +34,7 @@ harry_private_selftest (bool verbose)
     hconfig_test (verbose);
     vcache_test (verbose);
     hmatrix_test (verbose);
+    hist_test (verbose);
     kern_distance_test (verbose);
     kern_subsequence_test (verbose);
     kern_spectrum_test (verbose);
@@ -33,15 +33,27 @@ static default_t defaults[] = {
     {I "", "reverse_str", CONFIG_TYPE_BOOL, {.num = CONFIG_FALSE}},
     {I "", "stoptoken_file", CONFIG_TYPE_STRING, {.str = ""}},
     {I "", "soundex", CONFIG_TYPE_BOOL, {.num = CONFIG_FALSE}},
+    {I "", "update_file", CONFIG_TYPE_STRING, {.str = ""}},
     {M "", "measure", CONFIG_TYPE_STRING, {.str = "dist_levenshtein"}},
     {M "", "granularity", CONFIG_TYPE_STRING, {.str = "bytes"}},
     {M "", "token_delim", CONFIG_TYPE_STRING, {.str = " %0a%0d"}},
     {M "", "num_threads", CONFIG_TYPE_INT, {.num = 0}},
     {M "", "cache_size", CONFIG_TYPE_INT, {.num = 1}},
+    {M "", "cache_ways", CONFIG_TYPE_INT, {.num = 4}},
+    {M "", "cache_file", CONFIG_TYPE_STRING, {.str = ""}},
+    {M "", "cache_file_size", CONFIG_TYPE_INT, {.num = 64}},
+    {M "", "cache_readonly", CONFIG_TYPE_BOOL, {.num = CONFIG_FALSE}},
     {M "", "global_cache", CONFIG_TYPE_BOOL, {.num = CONFIG_FALSE}},
     {M "", "col_range", CONFIG_TYPE_STRING, {.str = ""}},
     {M "", "row_range", CONFIG_TYPE_STRING, {.str = ""}},
     {M "", "split", CONFIG_TYPE_STRING, {.str = ""}},
+    {M "", "matrix_file", CONFIG_TYPE_STRING, {.str = ""}},
+    {M "", "top_k", CONFIG_TYPE_INT, {.num = 0}},
+    {M "", "max_distance", CONFIG_TYPE_FLOAT, {.flt = -1.0}},
+    {M "", "min_similarity", CONFIG_TYPE_FLOAT, {.flt = -1.0}},
+    {M "", "prefilter", CONFIG_TYPE_FLOAT, {.flt = -1.0}},
+    {M "", "lsh", CONFIG_TYPE_STRING, {.str = ""}},
+    {M "", "lsh_qgram", CONFIG_TYPE_INT, {.num = 0}},
     {M ".dist_hamming", "norm", CONFIG_TYPE_STRING, {.str = "none"}},
     {M ".dist_levenshtein", "norm", CONFIG_TYPE_STRING, {.str = "none"}},
     {M ".dist_levenshtein", "cost_ins", CONFIG_TYPE_FLOAT, {.flt = 1.0}},
@@ -79,6 +91,7 @@ static default_t defaults[] = {
     {M ".kern_spectrum", "length", CONFIG_TYPE_INT, {.num = 3}},
     {M ".kern_spectrum", "norm", CONFIG_TYPE_STRING, {.str = "none"}},
     {M ".sim_coefficient", "matching", CONFIG_TYPE_STRING, {.str = "bin"}},
+    {M ".sim_coefficient", "sketch", CONFIG_TYPE_INT, {.num = 0}},
     {O "", "output_format", CONFIG_TYPE_STRING, {.str = "text"}},
     {O "", "precision", CONFIG_TYPE_INT, {.num = 0}},
     {O "", "separator", CONFIG_TYPE_STRING, {.str = ","}},
@@ -89,6 +102,13 @@ static default_t defaults[] = {
     {NULL}
 };
 
+/* Settings without influence on computed values */
+static const char *volatiles[] = {
+    "num_threads", "cache_size", "cache_ways", "cache_file",
+    "cache_file_size", "cache_readonly", "global_cache", "col_range",
+    "row_range", "split", "matrix_file", "top_k", "min_similarity", NULL
+};
+
 /**
  * Print a configuration setting.
  * @param f File stream to print to
@@ -157,6 +177,76 @@ void config_fprint(FILE *f, config_t * cfg)
     config_setting_fprint(f, config_root_setting(cfg), 0);
 }
 
+/**
+ * Checks whether a setting has no influence on computed values.
+ * @param n Name of setting
+ * @return true if setting is volatile
+ */
+static int config_volatile(const char *n)
+{
+    int i;
+    for (i = 0; n && volatiles[i]; i++)
+        if (!strcmp(n, volatiles[i]))
+            return TRUE;
+    return FALSE;
+}
+
+/**
+ * Hashes a configuration setting and its children recursively.
+ * @param cs Configuration setting
+ * @param h Hash value to update
+ * @return updated hash value
+ */
+static uint64_t config_setting_hash(config_setting_t * cs, uint64_t h)
+{
+    int i, b;
+    double f;
+    cfg_int j;
+    char *n = config_setting_name(cs);
+
+    if (config_volatile(n))
+        return h;
+    if (n)
+        h = (h ^ hash_str(n, strlen(n))) * 0x100000001b3ULL;
+
+    switch (config_setting_type(cs)) {
+    case CONFIG_TYPE_GROUP:
+        for (i = 0; i < config_setting_length(cs); i++)
+            h = config_setting_hash(config_setting_get_elem(cs, i), h);
+        return h;
+    case CONFIG_TYPE_STRING:
+        n = (char *) config_setting_get_string(cs);
+        return (h ^ hash_str(n, strlen(n))) * 0x100000001b3ULL;
+    case CONFIG_TYPE_FLOAT:
+        f = config_setting_get_float(cs);
+        return (h ^ hash_str((char *) &f, sizeof(f))) * 0x100000001b3ULL;
+    case CONFIG_TYPE_INT:
+        j = config_setting_get_int(cs);
+        return (h ^ hash_str((char *) &j, sizeof(j))) * 0x100000001b3ULL;
+    case CONFIG_TYPE_BOOL:
+        b = config_setting_get_bool(cs);
+        return (h ^ (b + 1)) * 0x100000001b3ULL;
+    default:
+        return h;
+    }
+}
+
+/**
+ * Computes a fingerprint of a configuration group. Settings that do not
+ * influence computed values, such as the number of threads or the cache
+ * size, are skipped. The fingerprint is used to tag persistent values.
+ * @param cfg configuration
+ * @param path Path of group, e.g. "measures"
+ * @return fingerprint (0 if the group does not exist)
+ */
+uint64_t config_fingerprint(config_t * cfg, const char *path)
+{
+    config_setting_t *cs = config_lookup(cfg, path);
+    if (!cs)
+        return 0;
+    return config_setting_hash(cs, 0xcbf29ce484222325ULL);
+}
+
 /**
  * The functions add default values to unspecified parameters.
  * @param cfg configuration
@@ -39,5 +39,6 @@ typedef struct
 void config_print(config_t *);
 int config_check(config_t *);
 void config_fprint(FILE *, config_t *);
+uint64_t config_fingerprint(config_t *, const char *);
 void hconfig_test (bool verbose);
 #endif /* HCONFIG_H */
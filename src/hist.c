@@ -0,0 +1,580 @@
+/*
+ * Harry - A Tool for Measuring String Similarity
+ * Copyright (C) 2013-2015 Konrad Rieck (konrad@mlsec.org)
+ * --
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.  This program is distributed without any
+ * warranty. See the GNU General Public License for more details.
+ */
+
+#include "harry_classes.h"
+
+/**
+ * @defgroup hist Histograms
+ * Histograms of the symbols of strings for bag-based measures. Bytes and
+ * bits are counted in a dense array of HIST_DENSE counts on the stack.
+ * Tokens are counted in a flat open-addressed table in the scratch
+ * memory of the measure and stored as sorted array of distinct symbols
+ * with counts. This array is computed once and attached to the string,
+ * such that comparing two strings merges two sorted arrays and does not
+ * allocate memory.
+ *
+ * For large collections, coefficients can be estimated from MinHash
+ * sketches computed once per string during preprocessing. Comparing two
+ * sketches takes O(k) time for k bins, independent of the length of the
+ * strings.
+ *
+ * Li, Owen, Zhang. One Permutation Hashing. Advances in Neural
+ * Information Processing Systems, 3113-3121, 2012.
+ *
+ * Shrivastava, Li. Densifying One Permutation Hashing via Rotation for
+ * Fast Near Neighbor Search. International Conference on Machine
+ * Learning, 557-565, 2014.
+ * @{
+ */
+
+/**
+ * Histogram of the tokens of a string
+ */
+typedef struct
+{
+    int n;              /**< Number of distinct tokens */
+    uint32_t *cnts;     /**< Counts of tokens */
+    sym_t syms[];       /**< Sorted distinct tokens */
+} hist_t;
+
+/* Histograms larger by this factor are searched instead of merged */
+#define HIST_SEARCH     16
+
+/**
+ * Compares two symbols
+ * @param x first symbol
+ * @param y second symbol
+ * @return result as a signed integer
+ */
+static int cmp_sym(const void *x, const void *y)
+{
+    sym_t a = *((sym_t *) x), b = *((sym_t *) y);
+    return a > b ? +1 : (a < b ? -1 : 0);
+}
+
+/**
+ * Computes the histogram of the tokens of a string. The tokens are
+ * counted in a table with linear probing at a load below one half.
+ * @param measure measure providing scratch memory
+ * @param x string of tokens
+ * @return histogram or NULL on error
+ */
+static hist_t *hist_new(measures_t *measure, hstring_t *x)
+{
+    int i, j, n = 0, cap = 16;
+    hist_t *h;
+
+    while (cap < 2 * x->len)
+        cap *= 2;
+
+    /* Keys and counts share one block, such that one release frees both */
+    sym_t *keys = (sym_t *) measures_alloc(measure,
+                  cap * (sizeof(sym_t) + sizeof(uint32_t)));
+    if (!keys)
+        return NULL;
+    uint32_t *cnts = (uint32_t *) (keys + cap);
+    memset(cnts, 0, cap * sizeof(uint32_t));
+
+    for (i = 0; i < x->len; i++) {
+        sym_t s = x->str.s[i];
+        j = (s * 0x9e3779b97f4a7c15ULL) >> 32 & (cap - 1);
+        while (cnts[j] && keys[j] != s)
+            j = (j + 1) & (cap - 1);
+        if (!cnts[j]) {
+            keys[j] = s;
+            n++;
+        }
+        cnts[j]++;
+    }
+
+    h = malloc(sizeof(hist_t) + n * (sizeof(sym_t) + sizeof(uint32_t)));
+    if (!h) {
+        measures_release(measure, keys);
+        return NULL;
+    }
+
+    /* Sort distinct tokens and look up their counts */
+    h->n = n;
+    h->cnts = (uint32_t *) (h->syms + n);
+    for (i = 0, n = 0; i < cap; i++)
+        if (cnts[i])
+            h->syms[n++] = keys[i];
+    qsort(h->syms, n, sizeof(sym_t), cmp_sym);
+
+    for (i = 0; i < n; i++) {
+        j = (h->syms[i] * 0x9e3779b97f4a7c15ULL) >> 32 & (cap - 1);
+        while (keys[j] != h->syms[i])
+            j = (j + 1) & (cap - 1);
+        h->cnts[i] = cnts[j];
+    }
+
+    measures_release(measure, keys);
+    return h;
+}
+
+/**
+ * Returns the histogram of a string of tokens. The histogram is computed
+ * once and attached to the string. If another thread attaches its
+ * histogram first, that one is used.
+ * @param measure measure providing scratch memory
+ * @param x string of tokens
+ * @return histogram or NULL on error
+ */
+static hist_t *hist_get(measures_t *measure, hstring_t *x)
+{
+    hist_t *h, *t;
+
+    h = __atomic_load_n((hist_t **) &x->hist, __ATOMIC_ACQUIRE);
+    if (h)
+        return h;
+
+    t = hist_new(measure, x);
+    if (!t)
+        return NULL;
+
+    if (__atomic_compare_exchange_n((hist_t **) &x->hist, &h, t, FALSE,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return t;
+    free(t);
+    return h;
+}
+
+/**
+ * Computes the overlap of two histograms of tokens. The sorted arrays are
+ * merged without branching on the order of the symbols. If one histogram
+ * is much smaller, its symbols are searched in the larger one instead.
+ * @param a first histogram
+ * @param b second histogram
+ * @param o overlap
+ */
+static void hist_merge(hist_t *a, hist_t *b, overlap_t *o)
+{
+    int i = 0, j = 0, lo, hi, mid, eq, shared = 0;
+    uint64_t inter = 0;
+    uint32_t m;
+    hist_t *c;
+
+    if (a->n > b->n) {
+        c = a;
+        a = b;
+        b = c;
+    }
+
+    if ((long) a->n * HIST_SEARCH < b->n) {
+        for (i = 0; i < a->n; i++) {
+            for (lo = j, hi = b->n; lo < hi;) {
+                mid = lo + (hi - lo) / 2;
+                if (b->syms[mid] < a->syms[i])
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            j = lo;
+            if (j == b->n)
+                break;
+            if (b->syms[j] == a->syms[i]) {
+                inter += MIN(a->cnts[i], b->cnts[j]);
+                shared++;
+            }
+        }
+    } else {
+        while (i < a->n && j < b->n) {
+            sym_t u = a->syms[i], v = b->syms[j];
+            eq = u == v;
+            m = MIN(a->cnts[i], b->cnts[j]);
+            inter += eq ? m : 0;
+            shared += eq;
+            i += u <= v;
+            j += v <= u;
+        }
+    }
+
+    o->inter = inter;
+    o->shared = shared;
+}
+
+/**
+ * Counts the symbols of a string of bytes or bits
+ * @param x string
+ * @param cnts dense histogram
+ */
+static void hist_dense(hstring_t *x, uint32_t *cnts)
+{
+    int i;
+
+    memset(cnts, 0, HIST_DENSE * sizeof(uint32_t));
+    if (x->type == HSTRING_TYPE_BYTE) {
+        for (i = 0; i < x->len; i++)
+            cnts[(unsigned char) x->str.c[i]]++;
+    } else {
+        for (i = 0; i < x->len; i++)
+            cnts[hstring_sym(x, i, HSTRING_TYPE_BIT)]++;
+    }
+}
+
+/**
+ * Computes the overlap of the histograms of two strings, that is, the sum
+ * of the minimum counts of each symbol and the number of distinct and
+ * shared symbols. All bag-based measures derive from these values.
+ * @param measure measure providing scratch memory
+ * @param x first string
+ * @param y second string
+ * @return overlap (all zero on error)
+ */
+overlap_t hist_overlap(measures_t *measure, hstring_t *x, hstring_t *y)
+{
+    overlap_t o = {0, 0, 0, 0};
+    uint32_t cx[HIST_DENSE], cy[HIST_DENSE];
+    uint64_t inter = 0;
+    int i, shared = 0, nx = 0, ny = 0;
+    hist_t *hx, *hy;
+
+    if (x->type != HSTRING_TYPE_TOKEN) {
+        hist_dense(x, cx);
+        hist_dense(y, cy);
+
+        /* Simple loop over all counts for vectorization */
+        for (i = 0; i < HIST_DENSE; i++) {
+            inter += MIN(cx[i], cy[i]);
+            shared += cx[i] && cy[i];
+            nx += cx[i] > 0;
+            ny += cy[i] > 0;
+        }
+
+        o.inter = inter;
+        o.shared = shared;
+        o.nx = nx;
+        o.ny = ny;
+        return o;
+    }
+
+    hx = hist_get(measure, x);
+    hy = hist_get(measure, y);
+    if (!hx || !hy) {
+        error("Could not allocate memory for histograms");
+        return o;
+    }
+
+    hist_merge(hx, hy, &o);
+    o.nx = hx->n;
+    o.ny = hy->n;
+    return o;
+}
+
+
+/* Sketches are limited to this many bins */
+#define SKETCH_MAX      65536
+/* Offset of values copied to empty bins per bin of distance */
+#define SKETCH_ROTATE   0x9e3779b97f4a7c15ULL
+
+/**
+ * Finalizer of MurmurHash3 as a permutation of 64-bit values
+ * @param k value
+ * @return hashed value
+ */
+static inline uint64_t fmix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/**
+ * Adds a symbol to a sketch. For multisets, the c-th occurrence of a
+ * symbol is a distinct element, such that the similarity of two
+ * sketches estimates the sum of minimum over the sum of maximum counts.
+ * @param s sketch
+ * @param sym symbol
+ * @param cnt count of symbol
+ */
+static void sketch_add(sketch_t *s, sym_t sym, uint32_t cnt)
+{
+    uint32_t c, n = s->binary ? 1 : cnt;
+    uint64_t h, bin;
+
+    for (c = 0; c < n; c++) {
+        h = fmix(sym ^ fmix(c + 1));
+        bin = ((h >> 32) * (uint64_t) s->k) >> 32;
+        if (h < s->mins[bin])
+            s->mins[bin] = h;
+    }
+}
+
+/**
+ * Fills empty bins of a sketch with the value of the next non-empty bin
+ * and an offset depending on the distance (rotation). Both sketches of a
+ * pair are filled alike, so that the agreement of bins remains an
+ * unbiased estimate of the Jaccard coefficient.
+ * @param s sketch
+ */
+static void sketch_densify(sketch_t *s)
+{
+    int i, j, idx, next;
+
+    for (i = 0; i < s->k && s->mins[i] == SKETCH_EMPTY; i++);
+    if (i == s->k)
+        return;
+
+    /* Walk backwards from a non-empty bin */
+    for (next = i, j = 1; j < s->k; j++) {
+        idx = (i - j + s->k) % s->k;
+        if (s->mins[idx] != SKETCH_EMPTY)
+            next = idx;
+        else
+            s->mins[idx] = s->mins[next] +
+                           ((next - idx + s->k) % s->k) * SKETCH_ROTATE;
+    }
+}
+
+/**
+ * Computes the MinHash sketch of a string for a coefficient measure with
+ * approximation enabled and attaches it to the string. Each symbol is
+ * hashed once into one of k bins (one permutation hashing).
+ * @param x string
+ * @param measure measure
+ */
+void hist_sketch(hstring_t *x, measures_t *measure)
+{
+    measures_opts_t *opts = measure->opts;
+    uint32_t cnts[HIST_DENSE];
+    sketch_t *s;
+    hist_t *h;
+    int i, k;
+
+    free(x->sketch);
+    x->sketch = NULL;
+
+    if (measure->func->measure_config != sim_coefficient_config ||
+        opts->sketch <= 0)
+        return;
+
+    k = MIN(opts->sketch, SKETCH_MAX);
+    s = malloc(sizeof(sketch_t) + k * sizeof(uint64_t));
+    if (!s) {
+        error("Could not allocate memory for sketch");
+        return;
+    }
+
+    s->k = k;
+    s->n = 0;
+    s->binary = opts->binary;
+    for (i = 0; i < k; i++)
+        s->mins[i] = SKETCH_EMPTY;
+
+    if (x->type != HSTRING_TYPE_TOKEN) {
+        hist_dense(x, cnts);
+        for (i = 0; i < HIST_DENSE; i++) {
+            if (cnts[i]) {
+                sketch_add(s, i, cnts[i]);
+                s->n++;
+            }
+        }
+    } else {
+        h = hist_get(measure, x);
+        if (!h) {
+            error("Could not allocate memory for histograms");
+            free(s);
+            return;
+        }
+        for (i = 0; i < h->n; i++)
+            sketch_add(s, h->syms[i], h->cnts[i]);
+        s->n = h->n;
+    }
+
+    sketch_densify(s);
+    x->sketch = s;
+}
+
+/**
+ * Estimates the overlap of two strings from their sketches. The fraction
+ * of agreeing bins estimates the Jaccard coefficient J of the sets (or
+ * multisets), from which the shared symbols (or the sum of minimum
+ * counts) follow as J / (1 + J) times the summed sizes. Strings without
+ * matching sketches are compared exactly.
+ * @param measure measure
+ * @param x first string
+ * @param y second string
+ * @return estimated overlap
+ */
+overlap_t hist_estimate(measures_t *measure, hstring_t *x, hstring_t *y)
+{
+    sketch_t *sx = (sketch_t *) x->sketch, *sy = (sketch_t *) y->sketch;
+    overlap_t o = {0, 0, 0, 0};
+    int i, eq = 0;
+    double j;
+
+    if (!sx || !sy || sx->k != sy->k || sx->binary != sy->binary ||
+        sx->k != MIN(measure->opts->sketch, SKETCH_MAX) ||
+        sx->binary != measure->opts->binary)
+        return hist_overlap(measure, x, y);
+
+    for (i = 0; i < sx->k; i++)
+        eq += sx->mins[i] == sy->mins[i];
+    j = eq / (double) sx->k;
+
+    o.nx = sx->n;
+    o.ny = sy->n;
+    if (sx->binary)
+        o.shared = j / (1 + j) * (sx->n + sy->n);
+    else
+        o.inter = j / (1 + j) * (x->len + y->len);
+    return o;
+}
+
+
+/**
+ * Computes the keys of the bands of a sketch for locality-sensitive
+ * hashing. The sketch covers the set of q-grams of a string, or its
+ * symbols for q = 1, and is split into bands of rows bins. Two strings
+ * with Jaccard coefficient J share the key of a band with probability
+ * J^rows, so similar strings likely collide in at least one band.
+ * @param measure measure providing scratch memory
+ * @param x string
+ * @param q length of q-grams
+ * @param bands number of bands
+ * @param rows number of bins per band
+ * @param keys keys of bands (out)
+ * @return true on success, false otherwise
+ */
+int hist_bands(measures_t *measure, hstring_t *x, int q, int bands, int rows,
+               uint64_t *keys)
+{
+    int i, j, n, k = bands * rows;
+    sketch_t *s;
+    uint64_t h;
+
+    s = measures_alloc(measure, sizeof(sketch_t) + k * sizeof(uint64_t));
+    if (!s) {
+        error("Could not allocate memory for sketch");
+        return FALSE;
+    }
+
+    s->k = k;
+    s->binary = TRUE;
+    for (i = 0; i < k; i++)
+        s->mins[i] = SKETCH_EMPTY;
+
+    /* Strings shorter than q form a single q-gram */
+    q = MAX(1, MIN(q, x->len));
+    n = x->len - q + 1;
+    for (i = 0; i < n; i++) {
+        for (j = 0, h = q; j < q; j++)
+            h = fmix(h ^ hstring_get(x, i + j));
+        sketch_add(s, h, 1);
+    }
+    sketch_densify(s);
+
+    for (i = 0; i < bands; i++) {
+        for (j = 0, h = i + 1; j < rows; j++)
+            h = fmix(h ^ s->mins[i * rows + j]);
+        keys[i] = h;
+    }
+
+    measures_release(measure, s);
+    return TRUE;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Self test of this class
+
+/*
+ * Computes the overlap of two strings by comparing all pairs of symbols
+ */
+static overlap_t overlap_full(hstring_t *x, hstring_t *y)
+{
+    overlap_t o = {0, 0, 0, 0};
+    int i, j, cx, cy, seen;
+
+    for (i = 0; i < x->len; i++) {
+        for (j = 0, seen = FALSE; j < i && !seen; j++)
+            seen = hstring_get(x, j) == hstring_get(x, i);
+        if (seen)
+            continue;
+
+        for (j = 0, cx = 0; j < x->len; j++)
+            cx += hstring_get(x, j) == hstring_get(x, i);
+        for (j = 0, cy = 0; j < y->len; j++)
+            cy += hstring_get(y, j) == hstring_get(x, i);
+
+        o.inter += MIN(cx, cy);
+        o.shared += cy > 0;
+        o.nx++;
+    }
+
+    for (i = 0; i < y->len; i++) {
+        for (j = 0, seen = FALSE; j < i && !seen; j++)
+            seen = hstring_get(y, j) == hstring_get(y, i);
+        o.ny += !seen;
+    }
+
+    return o;
+}
+
+void
+hist_test (bool verbose)
+{
+    printf (" * hist:");
+    //  @selftest
+    const char *gran[] = {"bytes", "tokens", "bits"};
+    char a[1001], b[1001];
+    int i, j, n, m, err = FALSE;
+    hstring_t *x, *y;
+
+    measures_t *measure = measures_new ("dist_bag");
+    assert (measure);
+    hstring_delim_set (".");
+
+    //  Random strings with few and many distinct symbols
+    for (i = 0; i < 300; i++) {
+        int alpha = i % 2 ? 4 : 64;
+        n = rand () % (i < 150 ? 30 : 1000);
+        m = rand () % (i % 10 ? 30 : 1000);
+        for (j = 0; j < n; j++)
+            a[j] = j % 3 == 2 ? '.' : 'a' + rand () % alpha;
+        for (j = 0; j < m; j++)
+            b[j] = j % 3 == 2 ? '.' : 'a' + rand () % alpha;
+        a[n] = b[m] = 0;
+
+        measures_config_set_string (measure, "measures.granularity",
+                                    gran[i % 3]);
+        x = hstring_new (a);
+        y = hstring_new (b);
+        hstring_preproc (x, measure);
+        hstring_preproc (y, measure);
+
+        overlap_t o1 = overlap_full (x, y);
+        overlap_t o2 = hist_overlap (measure, x, y);
+        overlap_t o3 = hist_overlap (measure, y, x);
+
+        if (o1.inter != o2.inter || o1.shared != o2.shared ||
+            o1.nx != o2.nx || o1.ny != o2.ny || o3.inter != o2.inter ||
+            o3.nx != o2.ny) {
+            printf ("Error %f != %f (%s, %d, %d)\n", o2.inter, o1.inter,
+                    gran[i % 3], x->len, y->len);
+            err = TRUE;
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
+
+    hstring_delim_reset ();
+    measures_destroy (&measure);
+    assert (!err);
+    //  @end
+
+    printf (" OK\n");
+}
+/** @} */
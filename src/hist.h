@@ -0,0 +1,51 @@
+/*
+ * Harry - A Tool for Measuring String Similarity
+ * Copyright (C) 2013-2015 Konrad Rieck (konrad@mlsec.org)
+ * --
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.  This program is distributed without any
+ * warranty. See the GNU General Public License for more details.
+ */
+
+#ifndef HIST_H
+#define HIST_H
+
+/** Number of counts of a dense histogram (bytes and bits) */
+#define HIST_DENSE      256
+
+/**
+ * Overlap of the histograms of two strings
+ */
+typedef struct
+{
+    double inter;       /**< Sum of minimum counts */
+    double shared;      /**< Number of shared symbols */
+    int nx;             /**< Number of distinct symbols in x */
+    int ny;             /**< Number of distinct symbols in y */
+} overlap_t;
+
+/** Value of empty bins of a sketch */
+#define SKETCH_EMPTY    UINT64_MAX
+
+/**
+ * MinHash sketch of the symbols of a string (one permutation hashing)
+ */
+typedef struct
+{
+    int k;              /**< Number of bins */
+    int binary;         /**< Sketch of set (1) or multiset (0) */
+    int n;              /**< Number of distinct symbols */
+    uint64_t mins[];    /**< Minimum hash per bin */
+} sketch_t;
+
+overlap_t hist_overlap (measures_t *measure, hstring_t *x, hstring_t *y);
+void hist_sketch (hstring_t *x, measures_t *measure);
+overlap_t hist_estimate (measures_t *measure, hstring_t *x, hstring_t *y);
+int hist_bands (measures_t *measure, hstring_t *x, int q, int bands, int rows,
+                uint64_t *keys);
+
+void
+    hist_test (bool verbose);
+#endif /* HIST_H */
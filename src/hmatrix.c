@@ -17,6 +17,8 @@
  */
 
 #include "harry_classes.h"
+#include <fcntl.h>
+#include <sys/mman.h>
 
 /* External variable */
 extern int verbose;
@@ -45,6 +47,15 @@ hmatrix_t *hmatrix_init(hstring_t *s, int n)
     m->row.start = 0;
     m->row.end = n;
     m->triangular = TRUE;
+    m->known = 0;
+    m->map = NULL;
+    m->map_size = 0;
+    m->rows = NULL;
+    m->locks = NULL;
+    m->cutoff = NAN;
+    m->lsh_bands = 0;
+    m->lsh_rows = 0;
+    m->lsh_qgram = 0;
 
     /* Initialized later */
     m->values = NULL;
@@ -178,10 +189,11 @@ void hmatrix_inferspec(const hmatrix_t *m, hmatrixspec_t * spec)
     assert(spec->b_left + spec->a + spec->b_right == width);
     assert(spec->b_top + spec->a + spec->b_bottom == height);
 
-    spec->n_top = width * spec->b_top;
-    spec->n_mid = spec->a * spec->b_left +
-        (pow(spec->a, 2) + spec->a) / 2 + spec->a * spec->b_right;
-    spec->n_bottom = width * spec->b_bottom;
+    spec->n_top = (unsigned long) width * spec->b_top;
+    spec->n_mid = (unsigned long) spec->a * spec->b_left +
+        ((unsigned long) spec->a * spec->a + spec->a) / 2 +
+        (unsigned long) spec->a * spec->b_right;
+    spec->n_bottom = (unsigned long) width * spec->b_bottom;
     spec->n = spec->n_top + spec->n_mid + spec->n_bottom;
 }
 
@@ -223,12 +235,12 @@ void hmatrix_split(hmatrix_t *m, char *str)
  * @param[in] spec The detailed matrix specification.
  * @param[in] rows The range determining the contained number of rows.
  */
-int hmatrix_split_ridx(const unsigned int N, const hmatrixspec_t * spec,
+int hmatrix_split_ridx(const unsigned long N, const hmatrixspec_t * spec,
                        const range_t * rows)
 {
     assert(spec != NULL);
 
-    unsigned int n = N;
+    unsigned long n = N;
     unsigned long width = (spec->b_left + spec->a + spec->b_right);
 
     if (n <= 0) {
@@ -318,13 +330,13 @@ void hmatrix_row_range(hmatrix_t *m, char *s)
 }
 
 /**
- * Allocate memory for matrix
+ * Determine the layout of the matrix. If the column and row ranges are
+ * equal, only the upper triangle is stored, otherwise the full rectangle.
  * @param m Matrix object
- * @return pointer to floats
  */
-float *hmatrix_alloc(hmatrix_t *m)
+static void hmatrix_layout(hmatrix_t *m)
 {
-    int cl, rl, k;
+    long cl, rl;
 
     /* Compute dimensions of matrix */
     cl = m->col.end - m->col.start;
@@ -340,6 +352,22 @@ float *hmatrix_alloc(hmatrix_t *m)
         m->size = cl * rl;
     }
 
+    hmatrixspec_t spec;
+    hmatrix_inferspec(m, &spec);
+    m->calcs = spec.n;
+}
+
+/**
+ * Allocate memory for matrix
+ * @param m Matrix object
+ * @return pointer to floats
+ */
+float *hmatrix_alloc(hmatrix_t *m)
+{
+    long k;
+
+    hmatrix_layout(m);
+
     /* Allocate memory */
     m->values = (float *) zmalloc(sizeof(float) * m->size);
     if (!m->values) {
@@ -347,11 +375,10 @@ float *hmatrix_alloc(hmatrix_t *m)
         return NULL;
     }
 
-    hmatrixspec_t spec;
-    hmatrix_inferspec(m, &spec);
-    m->calcs = spec.n;
-
-    /* Initialize to NaN values and count calculations */
+    /* Initialize to NaN values */
+#ifdef HAVE_OPENMP
+#pragma omp parallel for
+#endif
     for (k = 0; k < m->size; k++)
         m->values[k] = NAN;
 
@@ -359,15 +386,319 @@ float *hmatrix_alloc(hmatrix_t *m)
 }
 
 /**
- * Set a value in the matrix
+ * Map memory for matrix from a file. The file is created with a header
+ * and the values in the layout of the matrix. Pages of the file are
+ * written back by the kernel, such that the matrix may exceed the main
+ * memory. The values are not initialized to NaN to keep the file sparse
+ * until the values are computed.
+ * @param m Matrix object
+ * @param file Name of matrix file
+ * @return pointer to floats
+ */
+float *hmatrix_map(hmatrix_t *m, const char *file)
+{
+    hmatrix_header_t *h;
+
+    hmatrix_layout(m);
+    m->map_size = HMATRIX_HEADER + sizeof(float) * m->size;
+
+    int fd = open(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        error("Could not create matrix file '%s'", file);
+        return NULL;
+    }
+
+    if (ftruncate(fd, m->map_size) < 0) {
+        error("Could not allocate matrix file '%s'", file);
+        close(fd);
+        return NULL;
+    }
+
+    m->map = mmap(NULL, m->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, 0);
+    close(fd);
+    if (m->map == MAP_FAILED) {
+        error("Could not map matrix file '%s'", file);
+        m->map = NULL;
+        return NULL;
+    }
+
+    h = (hmatrix_header_t *) m->map;
+    memcpy(h->magic, HMATRIX_MAGIC, sizeof(h->magic));
+    h->col = m->col;
+    h->row = m->row;
+    h->triangular = m->triangular;
+    h->fsize = sizeof(float);
+    h->size = m->size;
+
+    info_msg(1, "Mapping matrix to '%s' (%.1fMb).", file,
+             m->map_size / (1024.0 * 1024.0));
+
+    m->values = (float *) ((char *) m->map + HMATRIX_HEADER);
+    return m->values;
+}
+
+/* Number of locks for sparse rows */
+#define HMATRIX_LOCKS   256
+
+/**
+ * Allocate sparse rows instead of the dense matrix
+ * @param m Matrix object
+ * @param largest Keep largest values (similarities) or smallest values
+ *        (distances)
+ * @return true on success, false otherwise
+ */
+static int rows_alloc(hmatrix_t *m, int largest)
+{
+    int i;
+
+    m->largest = largest;
+    if (m->rows)
+        return TRUE;
+
+    hmatrix_layout(m);
+    m->rows = (hrow_t *) zmalloc(RANGE_LENGTH(m->row) * sizeof(hrow_t));
+    m->locks = (rwlock_t *) zmalloc(HMATRIX_LOCKS * sizeof(rwlock_t));
+    if (!m->rows || !m->locks) {
+        error("Could not allocate sparse rows of matrix");
+        return FALSE;
+    }
+
+    for (i = 0; i < HMATRIX_LOCKS; i++)
+        rwlock_init(&m->locks[i]);
+
+    return TRUE;
+}
+
+/**
+ * Keep only the k most similar strings of each row. Instead of allocating
+ * the dense matrix, each row holds a bounded heap of cells that is sorted
+ * after the computation. The memory thus grows with the number of rows
+ * times k.
+ * @param m Matrix object
+ * @param k Number of cells per row
+ * @param largest Keep largest values (similarities) or smallest values
+ *        (distances)
+ * @return true on success, false otherwise
+ */
+int hmatrix_top_k(hmatrix_t *m, int k, int largest)
+{
+    if (k <= 0) {
+        error("Invalid number of cells per row (%d)", k);
+        return FALSE;
+    }
+
+    m->top_k = k;
+    return rows_alloc(m, largest);
+}
+
+/**
+ * Keep only cells with values at least (similarities) or at most
+ * (distances) the given bound. The matrix is stored as sparse rows and
+ * the memory grows with the number of retained cells. In combination
+ * with hmatrix_top_k() the rows are additionally bounded.
+ * @param m Matrix object
+ * @param bound Cutoff of values
+ * @param largest Keep largest values (similarities) or smallest values
+ *        (distances)
+ * @return true on success, false otherwise
+ */
+int hmatrix_cutoff(hmatrix_t *m, float bound, int largest)
+{
+    if (isnan(bound)) {
+        error("Invalid cutoff of matrix values");
+        return FALSE;
+    }
+
+    m->cutoff = bound;
+    return rows_alloc(m, largest);
+}
+
+/**
+ * Compare only candidate pairs of locality-sensitive hashing (LSH). The
+ * sketch of each string is split into bands and strings sharing the key
+ * of a band are compared by the exact measure. All other cells are
+ * missing from the sparse rows. A pair with Jaccard coefficient J of
+ * its q-grams becomes a candidate with probability 1 - (1 - J^rows)^bands.
+ * Strings in buckets larger than LSH_BUCKET are only paired with their
+ * next LSH_BUCKET neighbours in the bucket, ordered differently per band.
+ * @param m Matrix object
+ * @param bands Number of bands
+ * @param rows Number of bins per band
+ * @param q Length of q-grams (0 to choose by measure)
+ * @param largest Keep largest values (similarities) or smallest values
+ *        (distances)
+ * @return true on success, false otherwise
+ */
+int hmatrix_lsh(hmatrix_t *m, int bands, int rows, int q, int largest)
+{
+    if (bands <= 0 || rows <= 0 || (long) bands * rows > LSH_BINS) {
+        error("Invalid bands of LSH (%d:%d)", bands, rows);
+        return FALSE;
+    }
+
+    m->lsh_bands = bands;
+    m->lsh_rows = rows;
+    m->lsh_qgram = q;
+    return rows_alloc(m, largest);
+}
+
+/**
+ * Check whether the first cell is more similar than the second. Ties are
+ * broken by the column index to obtain a deterministic order.
+ * @param m Matrix object
+ * @param a First cell
+ * @param b Second cell
+ * @return true if a is more similar than b
+ */
+static inline int cell_better(hmatrix_t *m, hcell_t *a, hcell_t *b)
+{
+    if (a->val != b->val)
+        return m->largest ? a->val > b->val : a->val < b->val;
+    return a->col < b->col;
+}
+
+/**
+ * Restore the heap property of a row downwards from a cell. The root of
+ * the heap is the least similar cell of the row.
+ * @param m Matrix object
+ * @param h Cells of row
+ * @param n Number of cells
+ * @param i Index of cell
+ */
+static void heap_down(hmatrix_t *m, hcell_t *h, int n, int i)
+{
+    hcell_t t;
+    int j;
+
+    while ((j = 2 * i + 1) < n) {
+        if (j + 1 < n && cell_better(m, &h[j], &h[j + 1]))
+            j++;
+        if (!cell_better(m, &h[i], &h[j]))
+            break;
+        t = h[i], h[i] = h[j], h[j] = t;
+        i = j;
+    }
+}
+
+/**
+ * Add a cell to a sparse row. If the row is full, the least similar cell
+ * is replaced. Cells on the diagonal, NaN values and values beyond the
+ * cutoff are ignored. Rows without bound grow as needed.
  * @param m Matrix object
  * @param c Column index
  * @param r Row index
  * @param f Value
  */
-void hmatrix_set(hmatrix_t *m, int c, int r, float f)
+static void row_push(hmatrix_t *m, int c, int r, float f)
 {
-    int idx, i, j;
+    hrow_t *row = &m->rows[r - m->row.start];
+    hcell_t x = { c, f }, t;
+    rwlock_t *lock = &m->locks[r % HMATRIX_LOCKS];
+    int i, p;
+
+    if (c == r || isnan(f))
+        return;
+    if (!isnan(m->cutoff) && (m->largest ? f < m->cutoff : f > m->cutoff))
+        return;
+
+    rwlock_set_wlock(lock);
+    if (!row->cells) {
+        row->size = MIN(m->top_k ? m->top_k : 16, RANGE_LENGTH(m->col));
+        row->cells = (hcell_t *) malloc(row->size * sizeof(hcell_t));
+        if (!row->cells) {
+            error("Could not allocate sparse row of matrix");
+            row->size = 0;
+        }
+    } else if (!m->top_k && row->num == row->size) {
+        i = MIN(2 * row->size, RANGE_LENGTH(m->col));
+        hcell_t *cells = (hcell_t *) realloc(row->cells, i * sizeof(hcell_t));
+        if (!cells) {
+            error("Could not reallocate sparse row of matrix");
+        } else {
+            row->cells = cells;
+            row->size = i;
+        }
+    }
+
+    if (!m->top_k) {
+        /* Append cell to unbounded row */
+        if (row->num < row->size)
+            row->cells[row->num++] = x;
+    } else if (row->num < row->size) {
+        /* Insert cell and sift up */
+        i = row->num++;
+        row->cells[i] = x;
+        while (i > 0 && cell_better(m, &row->cells[p = (i - 1) / 2],
+                                    &row->cells[i])) {
+            t = row->cells[i], row->cells[i] = row->cells[p];
+            row->cells[p] = t;
+            i = p;
+        }
+    } else if (row->num > 0 && cell_better(m, &x, &row->cells[0])) {
+        /* Replace least similar cell */
+        row->cells[0] = x;
+        heap_down(m, row->cells, row->num, 0);
+    }
+    rwlock_unset_wlock(lock);
+}
+
+/**
+ * Sort the cells of all sparse rows from most to least similar
+ * @param m Matrix object
+ */
+static void rows_sort(hmatrix_t *m)
+{
+    int r, n;
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for private(n)
+#endif
+    for (r = 0; r < RANGE_LENGTH(m->row); r++) {
+        hcell_t *h = m->rows[r].cells, t;
+
+        /* Unbounded rows are not kept as heap */
+        if (!m->top_k)
+            for (n = m->rows[r].num / 2 - 1; n >= 0; n--)
+                heap_down(m, h, m->rows[r].num, n);
+
+        /* Heap sort: the least similar cells move to the end */
+        for (n = m->rows[r].num - 1; n > 0; n--) {
+            t = h[0], h[0] = h[n], h[n] = t;
+            heap_down(m, h, n, 0);
+        }
+    }
+}
+
+/**
+ * Get the cells of a sparse row. The cells are sorted from most to least
+ * similar after the matrix has been computed.
+ * @param m Matrix object
+ * @param r Row index
+ * @param cells Cells of row (out)
+ * @return number of cells or -1 if the matrix is not sparse
+ */
+int hmatrix_get_row(hmatrix_t *m, int r, hcell_t **cells)
+{
+    assert(m && cells);
+    if (!m->rows)
+        return -1;
+
+    assert(r >= m->row.start && r < m->row.end);
+    *cells = m->rows[r - m->row.start].cells;
+    return m->rows[r - m->row.start].num;
+}
+
+/**
+ * Compute the index of a cell in the memory of the matrix
+ * @param m Matrix object
+ * @param c Column index
+ * @param r Row index
+ * @return index of cell
+ */
+static long cell_index(hmatrix_t *m, int c, int r)
+{
+    long i, j;
 
     if (m->triangular) {
         if (c - m->col.start > r - m->row.start) {
@@ -377,12 +708,24 @@ void hmatrix_set(hmatrix_t *m, int c, int r, float f)
             i = c - m->col.start;
             j = r - m->row.start;
         }
-        idx = ((j - i) + i * (m->col.end - m->col.start) - i * (i - 1) / 2);
-    } else {
-        idx = (r - m->row.start) * (m->col.end - m->col.start);
-        idx += c - m->col.start;
+        return (j - i) + i * (m->col.end - m->col.start) - i * (i - 1) / 2;
     }
 
+    return (long) (r - m->row.start) * (m->col.end - m->col.start) +
+        (c - m->col.start);
+}
+
+/**
+ * Set a value in the matrix
+ * @param m Matrix object
+ * @param c Column index
+ * @param r Row index
+ * @param f Value
+ */
+void hmatrix_set(hmatrix_t *m, int c, int r, float f)
+{
+    long idx = cell_index(m, c, r);
+
     assert(idx < m->size);
     m->values[idx] = f;
 
@@ -391,7 +734,7 @@ void hmatrix_set(hmatrix_t *m, int c, int r, float f)
         r >= m->col.start && r < m->col.end &&
         c >= m->row.start && c < m->row.end) {
         /* This code is correct, although it looks strange. */
-        idx = (c - m->row.start) * (m->col.end - m->col.start);
+        idx = (long) (c - m->row.start) * (m->col.end - m->col.start);
         idx += r - m->col.start;
 
         assert(idx < m->size);
@@ -401,7 +744,7 @@ void hmatrix_set(hmatrix_t *m, int c, int r, float f)
 
 
 /**
- * Get a value from the matrix
+ * Get a value from the matrix. Cells missing in a sparse row are NaN.
  * @param m Matrix object
  * @param c Column coordinate
  * @param r Row coordinate
@@ -409,102 +752,839 @@ void hmatrix_set(hmatrix_t *m, int c, int r, float f)
  */
 float hmatrix_get(hmatrix_t *m, int c, int r)
 {
-    int idx, i, j;
+    hcell_t *cells;
+    int i, n;
+
+    /* Lookup cell in sparse row */
+    if (m->rows) {
+        n = hmatrix_get_row(m, r, &cells);
+        for (i = 0; i < n; i++)
+            if (cells[i].col == c)
+                return cells[i].val;
+        return NAN;
+    }
 
-    if (m->triangular) {
-        if (c - m->col.start > r - m->row.start) {
+    long idx = cell_index(m, c, r);
+
+    assert(idx < m->size);
+    return m->values[idx];
+}
+
+/**
+ * Check whether a cell holds a unique value of the matrix. For triangular
+ * matrices these are the cells on and above the diagonal, for rectangular
+ * matrices all cells except those mirrored by another cell of the matrix.
+ * @param m Matrix object
+ * @param c Column index
+ * @param r Row index
+ * @return true if the cell is unique
+ */
+static int cell_unique(hmatrix_t *m, int c, int r)
+{
+    if (m->triangular)
+        return c >= r;
+
+    /* Mirrored value is computed in another cell */
+    return !(r >= m->col.start && r < m->col.end &&
+             c >= m->row.start && c < m->row.end && c > r);
+}
+
+/**
+ * Load values of a previously computed matrix. The matrix needs to be
+ * stored in raw format (see output_raw.c) and cover all pairs of the
+ * first strings, that is, the strings must have been appended to the
+ * input since. Values of pairs of these strings are copied and marked as
+ * known, such that only pairs involving new strings are computed.
+ * @param m Matrix object (allocated)
+ * @param file Name of file with matrix in raw format
+ * @return number of strings with known values or -1 on error
+ */
+int hmatrix_load(hmatrix_t *m, const char *file)
+{
+    assert(m && file);
+    uint32_t hdr[3];
+    int r, c, k;
+    long cnt = 0;
+
+    /* Sparse rows receive the loaded values directly */
+    if (!m->rows && !m->values && !hmatrix_alloc(m))
+        return -1;
+
+    gzFile z = gzopen(file, "r");
+    if (!z) {
+        error("Could not open matrix file '%s'", file);
+        return -1;
+    }
+
+    if (gzread(z, hdr, sizeof(hdr)) != sizeof(hdr) ||
+        hdr[2] != sizeof(float) || hdr[0] != hdr[1] ||
+        hdr[0] > (uint32_t) m->num) {
+        error("Matrix in '%s' does not match the strings", file);
+        gzclose(z);
+        return -1;
+    }
+
+    float *row = (float *) zmalloc(MAX(hdr[1], 1) * sizeof(float));
+    if (!row) {
+        error("Could not allocate memory for matrix file");
+        gzclose(z);
+        return -1;
+    }
+
+    k = hdr[0];
+    for (r = 0; r < k; r++) {
+        if (gzread(z, row, k * sizeof(float)) != (int) (k * sizeof(float))) {
+            error("Truncated matrix in '%s'", file);
+            break;
+        }
+        if (r < m->row.start || r >= m->row.end)
+            continue;
+
+        for (c = m->col.start; c < MIN(m->col.end, k); c++) {
+            if (!cell_unique(m, c, r))
+                continue;
+            cnt++;
+            if (!m->rows) {
+                hmatrix_set(m, c, r, row[c]);
+                continue;
+            }
+            row_push(m, c, r, row[c]);
+            if (m->triangular || (r >= m->col.start && r < m->col.end &&
+                                  c >= m->row.start && c < m->row.end))
+                row_push(m, r, c, row[c]);
+        }
+    }
+
+    free(row);
+    gzclose(z);
+    if (r < k)
+        return -1;
+
+    m->known = k;
+    m->calcs -= cnt;
+    info_msg(1, "Loaded %ld values of %d strings from '%s'.", cnt, k, file);
+    return k;
+}
+
+/* Cache budget for the strings of one block (roughly a L2 cache) */
+#define TILE_CACHE      (256 * 1024)
+#define TILE_MIN        8
+#define TILE_MAX        512
+/* Number of blocks per thread the scheduler aims at */
+#define TILE_SPLIT      16
+
+/**
+ * Block of the matrix processed by one thread
+ */
+typedef struct
+{
+    range_t col;        /**< Columns of block */
+    range_t row;        /**< Rows of block */
+    double cost;        /**< Estimated cost of block */
+} tile_t;
+
+/**
+ * Queue of blocks of a thread. Threads take blocks from the head of their
+ * own queue and steal blocks from the tail of other queues.
+ */
+typedef struct
+{
+    tile_t *tiles;      /**< Blocks sorted by decreasing cost */
+    int head;           /**< Head of queue */
+    int tail;           /**< Tail of queue (exclusive) */
+    rwlock_t lock;      /**< Lock of queue */
+    double busy;        /**< Time spent computing */
+    int blocks;         /**< Number of processed blocks */
+    int stolen;         /**< Number of stolen blocks */
+} worker_t;
+
+/**
+ * Dynamic array of blocks
+ */
+typedef struct
+{
+    tile_t *tiles;      /**< Blocks */
+    int num;            /**< Number of blocks */
+    int size;           /**< Allocated blocks */
+} tiles_t;
+
+/**
+ * Determine the side length of blocks, such that the strings of the rows
+ * and columns of a block fit into the cache.
+ * @param m Matrix object
+ * @param s Array of string objects
+ * @return side length of blocks
+ */
+static int tile_size(hmatrix_t *m, hstring_t *s)
+{
+    double bytes = 0;
+    int i, n = 0, b;
+
+    for (i = m->col.start; i < m->col.end; i++, n++)
+        bytes += s[i].type == HSTRING_TYPE_TOKEN ?
+            s[i].len * sizeof(sym_t) : s[i].len;
+    for (i = m->row.start; i < m->row.end; i++, n++)
+        bytes += s[i].type == HSTRING_TYPE_TOKEN ?
+            s[i].len * sizeof(sym_t) : s[i].len;
+
+    /* Average size of a string including its object */
+    bytes = bytes / MAX(n, 1) + sizeof(hstring_t);
+    b = (int) (TILE_CACHE / (2 * bytes));
+
+    return MAX(TILE_MIN, MIN(TILE_MAX, b));
+}
+
+/**
+ * Estimate the cost of a block from the lengths of its strings. The
+ * estimate is derived from prefix sums of the string lengths, such that
+ * it does not require to visit each cell of the block.
+ * @param m Matrix object
+ * @param measure Similarity measure
+ * @param sum Prefix sums of string lengths
+ * @param t Block of matrix
+ * @return estimated cost
+ */
+static double tile_cost(hmatrix_t *m, measures_t *measure, double *sum,
+                        tile_t *t)
+{
+    double cl = sum[t->col.end] - sum[t->col.start];
+    double rl = sum[t->row.end] - sum[t->row.start];
+    double cn = RANGE_LENGTH(t->col), rn = RANGE_LENGTH(t->row);
+    double cost;
+
+    /* Each comparison has some constant overhead */
+    if (measure->func->cost == MEASURES_QUADRATIC)
+        cost = cl * rl + cn * rn;
+    else
+        cost = cl * rn + rl * cn + cn * rn;
+
+    /* Blocks on the diagonal are computed only halfway */
+    if (m->triangular && t->col.start < t->row.end &&
+        t->row.start < t->col.end)
+        cost /= 2;
+
+    return cost;
+}
+
+/**
+ * Add a block to an array of blocks. Blocks without unique values, that
+ * is, blocks below the diagonal of a triangular matrix, and blocks with
+ * known values only are skipped.
+ * @param a Array of blocks
+ * @param t Block of matrix
+ * @param m Matrix object
+ * @return false on error, true otherwise
+ */
+static int tile_add(tiles_t *a, tile_t *t, hmatrix_t *m)
+{
+    if (m->triangular && t->col.end <= t->row.start)
+        return TRUE;
+    if (t->col.end <= m->known && t->row.end <= m->known)
+        return TRUE;
+
+    if (a->num == a->size) {
+        a->size = a->size ? a->size * 2 : 64;
+        tile_t *p = (tile_t *) realloc(a->tiles, a->size * sizeof(tile_t));
+        if (!p) {
+            error("Could not allocate blocks of matrix");
+            return FALSE;
+        }
+        a->tiles = p;
+    }
+
+    a->tiles[a->num++] = *t;
+    return TRUE;
+}
+
+/**
+ * Split a block in halves until its estimated cost falls below a limit.
+ * This balances blocks with long strings against blocks with short ones.
+ * @param a Array of blocks
+ * @param t Block of matrix
+ * @param m Matrix object
+ * @param measure Similarity measure
+ * @param sum Prefix sums of string lengths
+ * @param limit Maximum cost of a block
+ * @return false on error, true otherwise
+ */
+static int tile_balance(tiles_t *a, tile_t *t, hmatrix_t *m,
+                        measures_t *measure, double *sum, double limit)
+{
+    tile_t h[2];
+    int k;
+
+    t->cost = tile_cost(m, measure, sum, t);
+    if (t->cost <= limit ||
+        (RANGE_LENGTH(t->col) == 1 && RANGE_LENGTH(t->row) == 1))
+        return tile_add(a, t, m);
+
+    /* Split along the longer side of the block */
+    h[0] = h[1] = *t;
+    if (RANGE_LENGTH(t->col) >= RANGE_LENGTH(t->row)) {
+        h[0].col.end = h[1].col.start = t->col.start + RANGE_LENGTH(t->col) / 2;
+    } else {
+        h[0].row.end = h[1].row.start = t->row.start + RANGE_LENGTH(t->row) / 2;
+    }
+
+    for (k = 0; k < 2; k++)
+        if (!tile_balance(a, &h[k], m, measure, sum, limit))
+            return FALSE;
+
+    return TRUE;
+}
+
+/**
+ * Compare blocks by decreasing cost
+ * @param x First block
+ * @param y Second block
+ * @return comparison result
+ */
+static int tile_cmp(const void *x, const void *y)
+{
+    double a = ((tile_t *) x)->cost, b = ((tile_t *) y)->cost;
+    return (a < b) - (a > b);
+}
+
+/**
+ * Split the matrix into blocks. Blocks are first sized for the cache and
+ * then split further by their estimated cost, so that each thread receives
+ * many blocks of similar cost.
+ * @param m Matrix object
+ * @param s Array of string objects
+ * @param measure Similarity measure
+ * @param threads Number of threads
+ * @param num Number of blocks (out, -1 on error)
+ * @return array of blocks
+ */
+static tile_t *tile_split(hmatrix_t *m, hstring_t *s, measures_t *measure,
+                          int threads, int *num)
+{
+    int r, c, i, b = tile_size(m, s);
+    double total = 0, *sum;
+    tiles_t a = { NULL, 0, 0 };
+    tile_t t;
+
+    *num = -1;
+
+    /* Prefix sums of string lengths */
+    sum = (double *) zmalloc((m->num + 1) * sizeof(double));
+    if (!sum) {
+        error("Could not allocate blocks of matrix");
+        return NULL;
+    }
+    for (i = 0; i < m->num; i++)
+        sum[i + 1] = sum[i] + s[i].len;
+
+    for (r = m->row.start; r < m->row.end; r += b) {
+        for (c = m->col.start; c < m->col.end; c += b) {
+            t.row.start = r;
+            t.row.end = MIN(r + b, m->row.end);
+            t.col.start = c;
+            t.col.end = MIN(c + b, m->col.end);
+            if (!tile_add(&a, &t, m))
+                goto err;
+            total += tile_cost(m, measure, sum, &t);
+        }
+    }
+
+    /* Split expensive blocks */
+    tiles_t cache = a;
+    a.tiles = NULL;
+    a.num = a.size = 0;
+    for (i = 0; i < cache.num; i++)
+        if (!tile_balance(&a, &cache.tiles[i], m, measure, sum,
+                          total / (threads * TILE_SPLIT)))
+            break;
+    free(cache.tiles);
+    if (i < cache.num)
+        goto err;
+
+    qsort(a.tiles, a.num, sizeof(tile_t), tile_cmp);
+
+    free(sum);
+    *num = a.num;
+    return a.tiles;
+
+err:
+    free(sum);
+    free(a.tiles);
+    return NULL;
+}
+
+/**
+ * Compute the values of a block. Only unique values are computed: For
+ * triangular matrices these are the cells on and above the diagonal,
+ * for rectangular matrices cells whose mirrored cell is also within the
+ * matrix are computed once and written twice. Known values loaded from
+ * a previous matrix are skipped.
+ * @param m Matrix object
+ * @param s Array of string objects
+ * @param measure Similarity measure
+ * @param t Block of matrix
+ * @return number of computed values
+ */
+static long tile_compute(hmatrix_t *m, hstring_t *s, measures_t *measure,
+                         tile_t *t)
+{
+    int c, r, i, j, mirror;
+    const int w = RANGE_LENGTH(m->col);
+    long idx, cnt = 0;
+    float f;
+
+    for (r = t->row.start; r < t->row.end; r++) {
+        if (m->triangular) {
             i = r - m->row.start;
-            j = c - m->col.start;
-        } else {
-            i = c - m->col.start;
-            j = r - m->row.start;
+            /* Start at the diagonal */
+            for (c = MAX(t->col.start, r); c < t->col.end; c++) {
+                if (c < m->known && r < m->known)
+                    continue;
+                j = c - m->col.start;
+                f = measures_compare(measure, &s[c], &s[r]);
+                cnt++;
+                if (m->rows) {
+                    row_push(m, c, r, f);
+                    row_push(m, r, c, f);
+                    continue;
+                }
+                idx = (j - i) + (long) i * w - (long) i * (i - 1) / 2;
+                m->values[idx] = f;
+            }
+            continue;
+        }
+
+        for (c = t->col.start; c < t->col.end; c++) {
+            if (!cell_unique(m, c, r) || (c < m->known && r < m->known))
+                continue;
+            mirror = r >= m->col.start && r < m->col.end &&
+                c >= m->row.start && c < m->row.end;
+
+            f = measures_compare(measure, &s[c], &s[r]);
+            cnt++;
+            if (m->rows) {
+                row_push(m, c, r, f);
+                if (mirror)
+                    row_push(m, r, c, f);
+                continue;
+            }
+            idx = (long) (r - m->row.start) * w + (c - m->col.start);
+            m->values[idx] = f;
+            if (mirror) {
+                idx = (long) (c - m->row.start) * w + (r - m->col.start);
+                m->values[idx] = f;
+            }
         }
-        idx = ((j - i) + i * (m->col.end - m->row.start) - i * (i - 1) / 2);
+    }
+
+    return cnt;
+}
+
+/**
+ * Schedule the write-back of the rows of a block to the matrix file.
+ * Rows are contiguous in both layouts, so the rows of a block occupy one
+ * range of pages. The write-back is asynchronous.
+ * @param m Matrix object
+ * @param t Block of matrix
+ */
+static void tile_flush(hmatrix_t *m, tile_t *t)
+{
+    long start, end;
+    uintptr_t a, b, page = sysconf(_SC_PAGESIZE);
+
+    if (m->triangular) {
+        start = cell_index(m, t->row.start, t->row.start);
+        end = cell_index(m, m->col.end - 1, t->row.end - 1) + 1;
     } else {
-        idx = (r - m->row.start) * (m->col.end - m->col.start);
-        idx += c - m->col.start;
+        start = (long) (t->row.start - m->row.start) * RANGE_LENGTH(m->col);
+        end = (long) (t->row.end - m->row.start) * RANGE_LENGTH(m->col);
     }
 
-    assert(idx < m->size);
-    return m->values[idx];
+    a = (uintptr_t) (m->values + start) & ~(page - 1);
+    b = (uintptr_t) (m->values + end);
+    if (b > a)
+        msync((void *) a, b - a, MS_ASYNC);
+}
+
+/**
+ * Fetch the next block of a thread. The thread first takes blocks from
+ * the head of its own queue and then steals from the tails of others.
+ * @param w Array of queues
+ * @param n Number of queues
+ * @param id Index of thread
+ * @param t Fetched block (out)
+ * @return true if a block has been fetched, false if all queues are empty
+ */
+static int worker_fetch(worker_t *w, int n, int id, tile_t *t)
+{
+    int k, v, found = FALSE;
+
+    for (k = 0; k < n && !found; k++) {
+        v = (id + k) % n;
+        rwlock_set_wlock(&w[v].lock);
+        if (w[v].head < w[v].tail) {
+            *t = k == 0 ? w[v].tiles[w[v].head++] : w[v].tiles[--w[v].tail];
+            found = TRUE;
+        }
+        rwlock_unset_wlock(&w[v].lock);
+    }
+
+    if (found && k > 1)
+        w[id].stolen++;
+
+    return found;
+}
+
+/**
+ * Entry of a bucket of LSH
+ */
+typedef struct
+{
+    uint64_t key;       /**< Key of band */
+    uint64_t ord;       /**< Order within bucket (hash of index and band) */
+    int idx;            /**< Index of string */
+} bucket_t;
+
+/**
+ * Dynamic array of candidate pairs
+ */
+typedef struct
+{
+    uint64_t *pairs;    /**< Row and column of cells */
+    long num;           /**< Number of pairs */
+    long size;          /**< Allocated pairs */
+} cands_t;
+
+/**
+ * Compare entries of buckets by key and order
+ * @param x First entry
+ * @param y Second entry
+ * @return comparison result
+ */
+static int bucket_cmp(const void *x, const void *y)
+{
+    const bucket_t *a = (const bucket_t *) x, *b = (const bucket_t *) y;
+
+    if (a->key != b->key)
+        return a->key > b->key ? +1 : -1;
+    if (a->ord != b->ord)
+        return a->ord > b->ord ? +1 : -1;
+    return a->idx - b->idx;
+}
+
+/**
+ * Compare candidate pairs
+ * @param x First pair
+ * @param y Second pair
+ * @return comparison result
+ */
+static int pair_cmp(const void *x, const void *y)
+{
+    uint64_t a = *((uint64_t *) x), b = *((uint64_t *) y);
+    return (a > b) - (a < b);
+}
+
+/**
+ * Add a cell to the candidates if it holds a unique value to compute
+ * @param m Matrix object
+ * @param a Array of candidates
+ * @param c Column index
+ * @param r Row index
+ * @return false on error, true otherwise
+ */
+static int cand_add(hmatrix_t *m, cands_t *a, int c, int r)
+{
+    if (c < m->col.start || c >= m->col.end ||
+        r < m->row.start || r >= m->row.end ||
+        !cell_unique(m, c, r) || (c < m->known && r < m->known))
+        return TRUE;
+
+    if (a->num == a->size) {
+        a->size = a->size ? a->size * 2 : 1024;
+        uint64_t *p = (uint64_t *) realloc(a->pairs, a->size * sizeof(uint64_t));
+        if (!p) {
+            error("Could not allocate candidates of LSH");
+            return FALSE;
+        }
+        a->pairs = p;
+    }
+
+    a->pairs[a->num++] = (uint64_t) r << 32 | (uint32_t) c;
+    return TRUE;
+}
+
+/**
+ * Remove candidate pairs found in several bands
+ * @param a Array of candidates
+ */
+static void cands_unique(cands_t *a)
+{
+    long i, j;
+
+    qsort(a->pairs, a->num, sizeof(uint64_t), pair_cmp);
+    for (i = 0, j = 0; i < a->num; i++)
+        if (j == 0 || a->pairs[j - 1] != a->pairs[i])
+            a->pairs[j++] = a->pairs[i];
+    a->num = j;
+}
+
+/**
+ * Collect the candidate pairs of LSH. Strings are bucketed by the key of
+ * each band and pairs within a bucket are added. In large buckets, for
+ * example of identical templates in logs, a string is only paired with
+ * the next LSH_BUCKET strings of the bucket, such that the candidates
+ * grow linearly with its size. Buckets are shuffled by a hash of index
+ * and band, such that each band pairs a string with other neighbours.
+ * Pairs found in several bands are added once.
+ * @param m Matrix object
+ * @param keys Keys of bands per string
+ * @param lo Index of first string
+ * @param n Number of strings
+ * @param a Array of candidates (out)
+ * @return false on error, true otherwise
+ */
+static int lsh_pairs(hmatrix_t *m, uint64_t *keys, int lo, int n, cands_t *a)
+{
+    int b, i, j, k, u, v, num, bands = m->lsh_bands;
+    bucket_t *e = (bucket_t *) malloc(MAX(n, 1) * sizeof(bucket_t));
+    if (!e) {
+        error("Could not allocate buckets of LSH");
+        return FALSE;
+    }
+
+    for (b = 0; b < bands; b++) {
+        for (i = 0, num = 0; i < n; i++) {
+            if (!keys[(long) i * bands])
+                continue;
+            e[num].key = keys[(long) i * bands + b];
+            e[num].idx = lo + i;
+            e[num].ord = MurmurHash64B(&e[num].idx, sizeof(int), b);
+            num++;
+        }
+        qsort(e, num, sizeof(bucket_t), bucket_cmp);
+
+        for (i = 0; i < num; i = j) {
+            for (j = i + 1; j < num && e[j].key == e[i].key; j++);
+            for (k = i; k < j; k++) {
+                for (v = k + 1; v < MIN(j, k + 1 + LSH_BUCKET); v++) {
+                    u = e[k].idx;
+                    if (!cand_add(m, a, e[v].idx, u) ||
+                        !cand_add(m, a, u, e[v].idx))
+                        goto err;
+                }
+            }
+        }
+        cands_unique(a);
+    }
+    free(e);
+    return TRUE;
+
+err:
+    free(e);
+    return FALSE;
+}
+
+/**
+ * Compute the values of the candidate pairs of LSH. The keys of the bands
+ * are computed once per string, the pairs sharing a key are collected
+ * and compared by the exact measure in parallel.
+ * @param m Matrix object
+ * @param s Array of string objects
+ * @param measure Similarity measure
+ * @param threads Number of threads
+ * @return number of computed values or -1 on error
+ */
+static long lsh_compute(hmatrix_t *m, hstring_t *s, measures_t *measure,
+                        int threads)
+{
+    int lo = MIN(m->col.start, m->row.start);
+    int n = MAX(m->col.end, m->row.end) - lo;
+    int i, err = FALSE, bands = m->lsh_bands, q = m->lsh_qgram;
+    cands_t a = { NULL, 0, 0 };
+    long k;
+
+    /* Edit distances compare q-grams, all other measures symbols */
+    if (q <= 0)
+        q = measure->prefilter_cost > 0 ? LSH_QGRAM : 1;
+
+    uint64_t *keys = (uint64_t *) zmalloc(MAX(n, 1) * bands * sizeof(uint64_t));
+    if (!keys) {
+        error("Could not allocate keys of LSH");
+        return -1;
+    }
+
+    /* Strings outside of the ranges keep a zero key */
+#ifdef HAVE_OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 64) reduction(|:err)
+#endif
+    for (i = 0; i < n; i++) {
+        int j = lo + i, b;
+        if ((j < m->col.start || j >= m->col.end) &&
+            (j < m->row.start || j >= m->row.end))
+            continue;
+        err |= !hist_bands(measure, &s[j], q, bands, m->lsh_rows,
+                           keys + (long) i * bands);
+        /* Zero marks unused strings */
+        for (b = 0; b < bands; b++)
+            keys[(long) i * bands + b] |= !keys[(long) i * bands + b];
+    }
+
+    if (err || !lsh_pairs(m, keys, lo, n, &a)) {
+        free(keys);
+        free(a.pairs);
+        return -1;
+    }
+    free(keys);
+
+    info_msg(1, "Comparing %ld of %ld pairs with LSH (%d bands, %d rows, "
+             "%d-grams).", a.num, m->calcs, bands, m->lsh_rows, q);
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel for num_threads(threads) schedule(dynamic, 256)
+#endif
+    for (k = 0; k < a.num; k++) {
+        int c = (int) (uint32_t) a.pairs[k], r = (int) (a.pairs[k] >> 32);
+        float f = measures_compare(measure, &s[c], &s[r]);
+
+        row_push(m, c, r, f);
+        if (m->triangular || (r >= m->col.start && r < m->col.end &&
+                              c >= m->row.start && c < m->row.end))
+            row_push(m, r, c, f);
+    }
+
+    k = a.num;
+    free(a.pairs);
+    return k;
 }
 
-/*[>**/
- /** Compute similarity measure and fill matrix*/
- /** @param m Matrix object*/
- /** @param s Array of string objects*/
- /** @param measure Similarity measure*/
-/*<]*/
-/*void hmatrix_compute(hmatrix_t *m, hstring_t *s,*/
-                     /*double (*measure) (hstring_t, hstring_t))*/
-/*{*/
-    /*assert(m);*/
-
-    /*int cnt = 0, n;*/
-    /*double ts, ts1 = time_stamp(), ts2 = ts1;*/
-    /*float f;*/
-
-    /*n = (m->col.end - m->col.start) * (m->row.end - m->row.start);*/
-
-/*#ifdef HAVE_OPENMP*/
-/*#pragma omp parallel for private(ts)*/
-/*#endif*/
-    /*for (int k = 0; k < n; k++) {*/
-        /*int c = k / (m->row.end - m->row.start) + m->col.start;*/
-        /*int r = k % (m->row.end - m->row.start) + m->row.start;*/
-
-        /*[>Skip values that have been computed earlier<]*/
-        /*f = hmatrix_get(m, c, r);*/
-        /*if (!isnan(f))*/
-            /*continue;*/
-
-        /*[>Set value in matrix<]*/
-        /*f = measure(s[c], s[r]);*/
-        /*hmatrix_set(m, c, r, f);*/
-
-        /*if (verbose || log_line) {*/
-            /*[>*/
-             /** Update internal counter. Note that we have slightly more*/
-             /** calculations as expected, since we don't lock the matrix.*/
-             /** Moreover, this update is not thread-safe and the progress*/
-             /** bar might not be correct.*/
-/*<]*/
-            /*if (cnt < m->calcs)*/
-                /*cnt++;*/
-
-            /*[>Continue if less than 100ms have passed<]*/
-            /*ts = time_stamp();*/
-            /*if (ts - ts1 < 0.1)*/
-                /*continue;*/
-
-            /*[>Lock only if something is displayed<]*/
-/*#ifdef HAVE_OPENMP*/
-/*#pragma omp critical*/
-/*#endif*/
-            /*{*/
-                /*[>Update progress bar every 100ms<]*/
-                /*if (verbose) {*/
-                    /*prog_bar(0, m->calcs, cnt);*/
-                    /*ts1 = ts;*/
-                /*}*/
-
-                /*[>Print log line every minute if enabled<]*/
-                /*if (log_line && ts - ts2 > 60) {*/
-                    /*log_print(0, m->calcs, cnt);*/
-                    /*ts2 = ts;*/
-                /*}*/
-            /*}*/
-        /*}*/
-    /*}*/
-
-    /*if (verbose) {*/
-        /*prog_bar(0, m->calcs, m->calcs);*/
-    /*}*/
-
-    /*if (log_line) {*/
-        /*log_print(0, m->calcs, m->calcs);*/
-    /*}*/
-/*}*/
+/**
+ * Compute similarity measure and fill matrix. The matrix is split into
+ * blocks of rows and columns, such that the strings of a block stay in
+ * the cache of the processing thread. Blocks are distributed by their
+ * estimated cost and idle threads steal blocks from busy ones.
+ * @param m Matrix object
+ * @param s Array of string objects
+ * @param measure Similarity measure
+ * @return true on success, false otherwise
+ */
+int hmatrix_compute(hmatrix_t *m, hstring_t *s, measures_t *measure)
+{
+    assert(m && s && measure);
+
+    int k, num, threads = 1;
+    long cnt = 0;
+    double ts0 = time_stamp(), ts1 = ts0, ts2 = ts0, wall;
+
+    if (!m->values && !m->rows && !hmatrix_alloc(m))
+        return FALSE;
+
+#ifdef HAVE_OPENMP
+    config_lookup_int(measure->cfg, "measures.num_threads", &threads);
+    if (threads <= 0)
+        threads = omp_get_max_threads();
+#endif
+
+    /* Only candidate pairs of LSH are compared */
+    if (m->lsh_bands > 0) {
+        if (lsh_compute(m, s, measure, threads) < 0)
+            return FALSE;
+        goto done;
+    }
+
+    tile_t *tiles = tile_split(m, s, measure, threads, &num);
+    if (num == 0)
+        goto done;
+
+    worker_t *workers = (worker_t *) zmalloc(threads * sizeof(worker_t));
+    if (!tiles || !workers) {
+        error("Could not schedule computation of matrix");
+        free(tiles);
+        free(workers);
+        return FALSE;
+    }
+
+    /* Deal blocks round-robin, such that each queue starts expensive */
+    for (k = 0; k < threads; k++) {
+        workers[k].tiles = tiles + k * (num / threads) + MIN(k, num % threads);
+        workers[k].tail = num / threads + (k < num % threads);
+        rwlock_init(&workers[k].lock);
+    }
+    tile_t *sorted = (tile_t *) zmalloc(MAX(num, 1) * sizeof(tile_t));
+    for (k = 0; sorted && k < num; k++) {
+        int q = k % threads;
+        int p = workers[q].tiles - tiles + k / threads;
+        sorted[p] = tiles[k];
+    }
+    if (sorted)
+        memcpy(tiles, sorted, num * sizeof(tile_t));
+    free(sorted);
+
+#ifdef HAVE_OPENMP
+#pragma omp parallel num_threads(threads)
+#endif
+    {
+        int id = 0;
+        tile_t t;
+#ifdef HAVE_OPENMP
+        id = omp_get_thread_num();
+#endif
+        while (worker_fetch(workers, threads, id, &t)) {
+            double ts = time_stamp();
+            long n = tile_compute(m, s, measure, &t);
+            if (m->map)
+                tile_flush(m, &t);
+            workers[id].busy += time_stamp() - ts;
+            workers[id].blocks++;
+
+            if (!verbose && !log_line)
+                continue;
+
+#ifdef HAVE_OPENMP
+#pragma omp critical
+#endif
+            {
+                cnt += n;
+                ts = time_stamp();
+
+                /* Update progress bar every 100ms */
+                if (verbose && ts - ts1 > 0.1) {
+                    prog_bar(measure->cache, 0, m->calcs, cnt);
+                    ts1 = ts;
+                }
+
+                /* Print log line every minute if enabled */
+                if (log_line && ts - ts2 > 60) {
+                    log_print(measure->cache, 0, m->calcs, cnt);
+                    ts2 = ts;
+                }
+            }
+        }
+    }
+
+    if (verbose)
+        prog_bar(measure->cache, 0, m->calcs, m->calcs);
+    if (log_line)
+        log_print(measure->cache, 0, m->calcs, m->calcs);
+
+    /* Report load of threads */
+    wall = time_stamp() - ts0;
+    for (k = 0; k < threads; k++) {
+        info_msg(1, "Thread %d: %.2fs busy, %.2fs idle, %d blocks "
+                 "(%d stolen).", k, workers[k].busy,
+                 MAX(wall - workers[k].busy, 0), workers[k].blocks,
+                 workers[k].stolen);
+        rwlock_destroy(&workers[k].lock);
+    }
+
+    free(workers);
+    free(tiles);
+
+done:
+    /* Write back remaining values, e.g. mirrored cells */
+    if (m->map)
+        msync(m->map, m->map_size, MS_ASYNC);
+    if (m->rows)
+        rows_sort(m);
+    return TRUE;
+}
 
 
 /**
@@ -567,8 +1647,16 @@ void hmatrix_destroy(hmatrix_t *m)
     if (!m)
         return;
 
-    if (m->values)
+    if (m->map)
+        munmap(m->map, m->map_size);
+    else if (m->values)
         free(m->values);
+    for (int i = 0; m->rows && i < RANGE_LENGTH(m->row); i++)
+        free(m->rows[i].cells);
+    for (int i = 0; m->locks && i < HMATRIX_LOCKS; i++)
+        rwlock_destroy(&m->locks[i]);
+    free(m->rows);
+    free(m->locks);
     for (int i = 0; m->srcs && i < m->num; i++)
         if (m->srcs[i])
             free(m->srcs[i]);
@@ -586,10 +1674,365 @@ void hmatrix_destroy(hmatrix_t *m)
 //  Self test of this class
 
 
+/*
+ * Ranges for testing the computation of matrices
+ */
+static char *test_ranges[][2] = {
+    {"", ""},
+    {"5:30", "0:20"},
+    {"0:10", "20:40"},
+    {"10:60", "30:31"},
+    {NULL}
+};
+
 void
 hmatrix_test (bool verbose)
 {
-    printf (" * hmatrix: SKIP.\n");
+    printf (" * hmatrix:");
+
+    //  @selftest
+    int i, j, k, c, r, n = 60, err = FALSE;
+    char buf[4096], col[32], row[32];
+    measures_t *measure = measures_new ("dist_hamming");
+    hstring_t *strs = (hstring_t *) zmalloc (n * sizeof (hstring_t));
+    assert (measure && strs);
+
+    for (i = 0; i < n; i++) {
+        /* Long strings to obtain several blocks */
+        for (j = 0; j < 3000 + i; j++)
+            buf[j] = 'a' + (j * (i % 7 + 1)) % 13;
+        buf[j] = 0;
+        hstring_t *x = hstring_new (buf);
+        hstring_preproc (x, measure);
+        strs[i] = *x;
+        free (x);
+    }
+
+    for (k = 0; test_ranges[k][0] && !err; k++) {
+        hmatrix_t *m = hmatrix_init (strs, n);
+        strcpy (col, test_ranges[k][0]);
+        strcpy (row, test_ranges[k][1]);
+        hmatrix_col_range (m, col);
+        hmatrix_row_range (m, row);
+        hmatrix_alloc (m);
+        hmatrix_compute (m, strs, measure);
+
+        for (r = m->row.start; r < m->row.end && !err; r++) {
+            for (c = m->col.start; c < m->col.end && !err; c++) {
+                float f = measures_compare (measure, &strs[c], &strs[r]);
+                if (fabs (hmatrix_get (m, c, r) - f) > 1e-6) {
+                    printf ("Error %f != %f (%d, %d)\n",
+                            hmatrix_get (m, c, r), f, c, r);
+                    err = TRUE;
+                }
+            }
+        }
+        hmatrix_destroy (m);
+    }
+
+    //  Update a matrix of appended strings from a raw matrix. Known values
+    //  are offset to check that they are loaded and not recomputed.
+    char path[] = "/tmp/harry-hmatrix-XXXXXX";
+    int fd = mkstemp (path);
+    uint32_t hdr[3] = { n - 10, n - 10, sizeof (float) };
+    FILE *f = fdopen (fd, "w");
+    assert (f);
+    fwrite (hdr, sizeof (hdr), 1, f);
+    for (r = 0; r < n - 10; r++) {
+        for (c = 0; c < n - 10; c++) {
+            float v = measures_compare (measure, &strs[c], &strs[r]) + 1000;
+            fwrite (&v, sizeof (float), 1, f);
+        }
+    }
+    fclose (f);
+
+    for (k = 0; test_ranges[k][0] && !err; k++) {
+        hmatrix_t *m = hmatrix_init (strs, n);
+        strcpy (col, test_ranges[k][0]);
+        strcpy (row, test_ranges[k][1]);
+        hmatrix_col_range (m, col);
+        hmatrix_row_range (m, row);
+        hmatrix_alloc (m);
+        assert (hmatrix_load (m, path) == n - 10);
+        hmatrix_compute (m, strs, measure);
+
+        for (r = m->row.start; r < m->row.end && !err; r++) {
+            for (c = m->col.start; c < m->col.end && !err; c++) {
+                float f = measures_compare (measure, &strs[c], &strs[r]);
+                if (c < n - 10 && r < n - 10)
+                    f += 1000;
+                if (fabs (hmatrix_get (m, c, r) - f) > 1e-3) {
+                    printf ("Error %f != %f (%d, %d)\n",
+                            hmatrix_get (m, c, r), f, c, r);
+                    err = TRUE;
+                }
+            }
+        }
+        hmatrix_destroy (m);
+    }
+
+    //  Known values also enter sparse rows. The largest values are kept,
+    //  such that the offset known values are selected.
+    for (k = 0; test_ranges[k][0] && !err; k++) {
+        hmatrix_t *m = hmatrix_init (strs, n);
+        strcpy (col, test_ranges[k][0]);
+        strcpy (row, test_ranges[k][1]);
+        hmatrix_col_range (m, col);
+        hmatrix_row_range (m, row);
+        assert (hmatrix_top_k (m, 3, TRUE));
+        assert (hmatrix_load (m, path) == n - 10);
+        hmatrix_compute (m, strs, measure);
+        assert (!m->values);
+
+        for (r = m->row.start; r < m->row.end && !err; r++) {
+            hcell_t *cells, best[3];
+            int num = 0;
+
+            for (c = m->col.start; c < m->col.end; c++) {
+                hcell_t x = { c, measures_compare (measure, &strs[c],
+                                                   &strs[r]) };
+                if (c < n - 10 && r < n - 10)
+                    x.val += 1000;
+                if (c == r || (num == 3 && !cell_better (m, &x, &best[2])))
+                    continue;
+                j = num < 3 ? num++ : 2;
+                while (j > 0 && cell_better (m, &x, &best[j - 1])) {
+                    best[j] = best[j - 1];
+                    j--;
+                }
+                best[j] = x;
+            }
+
+            err |= hmatrix_get_row (m, r, &cells) != num;
+            for (j = 0; j < num && !err; j++)
+                err |= cells[j].col != best[j].col ||
+                    fabs (cells[j].val - best[j].val) > 1e-3;
+        }
+        hmatrix_destroy (m);
+    }
+    unlink (path);
+    assert (!err);
+
+    //  Matrices mapped from a file match matrices in memory
+    strcpy (path, "/tmp/harry-hmatrix-XXXXXX");
+    close (mkstemp (path));
+    for (k = 0; test_ranges[k][0] && !err; k++) {
+        hmatrix_t *m = hmatrix_init (strs, n);
+        strcpy (col, test_ranges[k][0]);
+        strcpy (row, test_ranges[k][1]);
+        hmatrix_col_range (m, col);
+        hmatrix_row_range (m, row);
+        assert (hmatrix_map (m, path));
+        hmatrix_compute (m, strs, measure);
+
+        for (r = m->row.start; r < m->row.end && !err; r++)
+            for (c = m->col.start; c < m->col.end && !err; c++)
+                err |= hmatrix_get (m, c, r) !=
+                    measures_compare (measure, &strs[c], &strs[r]);
+
+        hmatrix_header_t *h = (hmatrix_header_t *) m->map;
+        assert (!memcmp (h->magic, HMATRIX_MAGIC, 8) && h->size == m->size);
+        hmatrix_destroy (m);
+    }
+    unlink (path);
+    assert (!err);
+
+    //  Sparse rows hold the k nearest strings of each row
+    for (k = 0; test_ranges[k][0] && !err; k++) {
+        hmatrix_t *m = hmatrix_init (strs, n);
+        strcpy (col, test_ranges[k][0]);
+        strcpy (row, test_ranges[k][1]);
+        hmatrix_col_range (m, col);
+        hmatrix_row_range (m, row);
+        assert (hmatrix_top_k (m, 3, FALSE));
+        hmatrix_compute (m, strs, measure);
+        assert (!m->values);
+
+        for (r = m->row.start; r < m->row.end && !err; r++) {
+            hcell_t *cells, best[3];
+            int num = 0;
+
+            /* Brute-force search of the nearest strings */
+            for (c = m->col.start; c < m->col.end; c++) {
+                hcell_t x = { c, measures_compare (measure, &strs[c],
+                                                   &strs[r]) };
+                if (c == r || (num == 3 && !cell_better (m, &x, &best[2])))
+                    continue;
+                j = num < 3 ? num++ : 2;
+                while (j > 0 && cell_better (m, &x, &best[j - 1])) {
+                    best[j] = best[j - 1];
+                    j--;
+                }
+                best[j] = x;
+            }
+
+            err |= hmatrix_get_row (m, r, &cells) != num;
+            for (j = 0; j < num && !err; j++)
+                err |= cells[j].col != best[j].col ||
+                    cells[j].val != best[j].val;
+        }
+        hmatrix_destroy (m);
+    }
+    assert (!err);
+
+    //  Sparse rows hold all strings within a bounded distance
+    measures_t *exact = measures_new ("dist_hamming");
+    measures_config_set_float (measure, "measures.max_distance", 100);
+    for (k = 0; test_ranges[k][0] && !err; k++) {
+        hmatrix_t *m = hmatrix_init (strs, n);
+        strcpy (col, test_ranges[k][0]);
+        strcpy (row, test_ranges[k][1]);
+        hmatrix_col_range (m, col);
+        hmatrix_row_range (m, row);
+        assert (hmatrix_cutoff (m, 100, FALSE));
+        hmatrix_compute (m, strs, measure);
+        assert (!m->values);
+
+        for (r = m->row.start; r < m->row.end && !err; r++) {
+            hcell_t *cells;
+            int num = hmatrix_get_row (m, r, &cells), found = 0;
+
+            /* Cells are sorted and match the exact distances */
+            for (j = 1; j < num && !err; j++)
+                err |= cell_better (m, &cells[j], &cells[j - 1]);
+            for (c = m->col.start; c < m->col.end && !err; c++) {
+                float f = measures_compare (exact, &strs[c], &strs[r]);
+                if (c == r || f > 100)
+                    continue;
+                for (j = 0; j < num && cells[j].col != c; j++);
+                err |= j == num || cells[j].val != f;
+                found++;
+            }
+            err |= found != num;
+        }
+        hmatrix_destroy (m);
+    }
+    measures_config_set_float (measure, "measures.max_distance", -1);
+    measures_destroy (&exact);
+    assert (!err);
+
+    hmatrix_t *m;
+
+    //  LSH compares candidate pairs only. Strings form clusters of near
+    //  duplicates, whose pairs are found, and all values are exact.
+    const char *lsh_measures[] = { "dist_levenshtein", "sim_jaccard", NULL };
+    for (k = 0; lsh_measures[k] && !err; k++) {
+        measures_t *lm = measures_new (lsh_measures[k]);
+        hstring_t *ls = (hstring_t *) zmalloc (n * sizeof (hstring_t));
+        int dist = k == 0, pairs = 0, found = 0;
+        assert (lm && ls);
+        measures_config_set_string (lm, "measures.granularity",
+                                    dist ? "bytes" : "tokens");
+        measures_config_set_string (lm, "measures.token_delim", " ");
+
+        for (i = 0; i < n; i++) {
+            /* Ten clusters with a few edits per string */
+            for (j = 0; j < 200; j++)
+                buf[j] = dist ? 'a' + ((j * 7 + (i % 10) * 13) ^ (j >> 2)) % 26
+                    : (j % 4 == 3 ? ' ' : 'a' + (j * (i % 10 + 3)) % 26);
+            for (j = 0; j < 3; j++)
+                buf[(i * 37 + j * 61) % 200] = dist ? '#' : 'z';
+            buf[200] = 0;
+            hstring_t *x = hstring_new (buf);
+            hstring_preproc (x, lm);
+            ls[i] = *x;
+            free (x);
+        }
+
+        m = hmatrix_init (ls, n);
+        assert (hmatrix_lsh (m, 16, 4, 0, !dist));
+        assert (hmatrix_compute (m, ls, lm));
+        assert (!m->values);
+
+        for (r = 0; r < n && !err; r++) {
+            hcell_t *cells;
+            int num = hmatrix_get_row (m, r, &cells);
+            for (j = 0; j < num && !err; j++)
+                err |= cells[j].val !=
+                    measures_compare (lm, &ls[cells[j].col], &ls[r]);
+            for (c = 0; c < n; c++) {
+                if (c == r || c % 10 != r % 10)
+                    continue;
+                for (j = 0; j < num && cells[j].col != c; j++);
+                found += j < num;
+                pairs++;
+            }
+            /* Few pairs of different clusters are candidates */
+            err |= num > 2 * (n / 10);
+        }
+        if (verbose)
+            printf ("\n  %s: %d of %d pairs found", lsh_measures[k],
+                    found, pairs);
+        err |= found < 0.95 * pairs;
+
+        hmatrix_destroy (m);
+        for (i = 0; i < n; i++) {
+            hstring_t *x = (hstring_t *) malloc (sizeof (hstring_t));
+            *x = ls[i];
+            hstring_destroy (&x);
+        }
+        free (ls);
+        measures_destroy (&lm);
+    }
+    assert (!err);
+    m = hmatrix_init (strs, n);
+    assert (!hmatrix_lsh (m, 0, 4, 0, TRUE));
+    hmatrix_destroy (m);
+
+    //  Buckets of identical strings pair most of the cluster across bands
+    measures_t *lm = measures_new ("dist_levenshtein");
+    hstring_t *same = (hstring_t *) zmalloc (1000 * sizeof (hstring_t));
+    for (i = 0; i < 1000; i++) {
+        hstring_t *x = hstring_new ("GET /index.html HTTP/1.1");
+        hstring_preproc (x, lm);
+        same[i] = *x;
+        free (x);
+    }
+    m = hmatrix_init (same, 1000);
+    assert (hmatrix_lsh (m, 16, 2, 0, FALSE));
+    assert (hmatrix_compute (m, same, lm));
+    long found = 0;
+    for (r = 0; r < 1000 && !err; r++) {
+        hcell_t *cells;
+        j = hmatrix_get_row (m, r, &cells);
+        err |= j > 16 * 2 * LSH_BUCKET + 1;
+        found += j;
+    }
+    if (verbose)
+        printf ("LSH recall of duplicate cluster: %.3f\n",
+                found / (1000.0 * 1000.0));
+    err |= found < 0.95 * 1000 * 1000;
+    hmatrix_destroy (m);
+    for (i = 0; i < 1000; i++)
+        free (same[i].str.c);
+    free (same);
+    measures_destroy (&lm);
+    assert (!err);
+
+    //  Indices of matrices with more than 2^32 cells do not overflow
+    hstring_t *big = (hstring_t *) zmalloc (100000 * sizeof (hstring_t));
+    m = hmatrix_init (big, 100000);
+    hmatrix_layout (m);
+    assert (m->triangular && m->size == 5000050000L && m->calcs == m->size);
+    assert (cell_index (m, 99999, 99999) == m->size - 1);
+    assert (cell_index (m, 99999, 99998) == m->size - 2);
+    strcpy (row, "50000:");
+    hmatrix_row_range (m, row);
+    hmatrix_layout (m);
+    assert (!m->triangular && m->size == 5000000000L);
+    assert (m->calcs == 50000L * 50000 + 50000L * 50001 / 2);
+    assert (cell_index (m, 99999, 99999) == m->size - 1);
+    hmatrix_destroy (m);
+    free (big);
+
+    //  Cleanup
+    for (i = 0; i < n; i++)
+        free (strs[i].str.c);
+    free (strs);
+    measures_destroy (&measure);
+    //  @end
+
+    printf (" OK\n");
 }
 
 /** @} */
@@ -23,6 +23,25 @@ typedef struct
 
 #define RANGE_LENGTH(r) (r.end -r.start)
 
+/**
+ * Cell of a sparse row
+ */
+typedef struct
+{
+    int col;      /**< Column index */
+    float val;    /**< Similarity value */
+} hcell_t;
+
+/**
+ * Sparse row of a matrix
+ */
+typedef struct
+{
+    hcell_t *cells;     /**< Cells of row */
+    int num;            /**< Number of cells */
+    int size;           /**< Allocated cells */
+} hrow_t;
+
 /**
  * Structure for a matrix
  */
@@ -33,13 +52,52 @@ typedef struct
     int num;            /**< Number of strings */
 
     float *values;      /**< Similarity values */
-    int size;           /**< Size of memory */
-    int calcs;          /**< Required calculations */
+    long size;          /**< Size of memory */
+    long calcs;         /**< Required calculations */
     range_t col;        /**< Column range */
     range_t row;        /**< Row range */
     int triangular;     /**< Flag for triangular storage */
+    int known;          /**< Number of leading strings with known values */
+    void *map;          /**< Mapping of matrix file (or NULL) */
+    size_t map_size;    /**< Size of mapping */
+
+    hrow_t *rows;       /**< Sparse rows (or NULL if dense) */
+    int top_k;          /**< Maximum number of cells per row */
+    int largest;        /**< Keep largest values (similarities) */
+    float cutoff;       /**< Cutoff of values (NaN for none) */
+    rwlock_t *locks;    /**< Locks of sparse rows */
+
+    int lsh_bands;      /**< Bands of LSH (0 if all pairs are compared) */
+    int lsh_rows;       /**< Bins per band of LSH */
+    int lsh_qgram;      /**< Length of q-grams of LSH (0 for default) */
 } hmatrix_t;
 
+/** Length of q-grams of LSH for edit distances */
+#define LSH_QGRAM       3
+/** Maximum number of bins of LSH sketches */
+#define LSH_BINS        4096
+/** Number of neighbours paired with a string in a bucket of LSH */
+#define LSH_BUCKET      128
+
+/** Magic bytes of a matrix file */
+#define HMATRIX_MAGIC   "HARRYMX1"
+/** Size of header of a matrix file (one page) */
+#define HMATRIX_HEADER  4096
+
+/**
+ * Header of a matrix file. The values follow at offset HMATRIX_HEADER in
+ * the layout of the matrix, that is, as triangle or rectangle.
+ */
+typedef struct
+{
+    char magic[8];      /**< Magic bytes */
+    range_t col;        /**< Column range */
+    range_t row;        /**< Row range */
+    int32_t triangular; /**< Flag for triangular storage */
+    uint32_t fsize;     /**< Size of a float */
+    uint64_t size;      /**< Number of values */
+} hmatrix_header_t;
+
 
 /**
  * Detailed structural specification of matrices.
@@ -113,11 +171,11 @@ typedef struct
  */
 typedef struct
 {
-    unsigned int n;
+    unsigned long n;
 
-    unsigned int n_top;
-    unsigned int n_mid;
-    unsigned int n_bottom;
+    unsigned long n_top;
+    unsigned long n_mid;
+    unsigned long n_bottom;
 
     unsigned int a;
     int b_top;
@@ -133,10 +191,15 @@ void hmatrix_inferspec(const hmatrix_t *, hmatrixspec_t *);
 void hmatrix_split(hmatrix_t *, char *);
 void hmatrix_split_ex(hmatrix_t *, const int, const int);
 float *hmatrix_alloc(hmatrix_t *);
+float *hmatrix_map(hmatrix_t *, const char *);
+int hmatrix_top_k(hmatrix_t *, int, int);
+int hmatrix_cutoff(hmatrix_t *, float, int);
+int hmatrix_lsh(hmatrix_t *, int, int, int, int);
+int hmatrix_get_row(hmatrix_t *, int, hcell_t **);
 float hmatrix_get(hmatrix_t *, int, int);
 void hmatrix_set(hmatrix_t *, int, int, float);
-/*void hmatrix_compute(hmatrix_t *, hstring_t *,*/
-                     /*double (*measure) (hstring_t, hstring_t));*/
+int hmatrix_compute(hmatrix_t *, hstring_t *, measures_t *);
+int hmatrix_load(hmatrix_t *, const char *);
 void hmatrix_destroy(hmatrix_t *);
 float hmatrix_benchmark(hmatrix_t *, hstring_t *,
                         double (*measure) (hstring_t, hstring_t), double);
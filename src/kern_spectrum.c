@@ -16,10 +16,10 @@
  * <hr>
  * <em>kern_spectrum</em>: Spectrum kernel
  *
- * The runtime complexity of the kernel is linear in the length of the
- * strings. However, the implementation is not very efficient, as the
- * k-mers are repeatedly extracted from the strings. A caching mechanism
- * might provide a considerable acceleration here.
+ * The k-mers of a string are extracted, hashed and sorted once. The
+ * sorted hashes are stored with their counts at the string, such that
+ * the kernel of two strings is a single merge of these spectra and the
+ * L2 norm of a string is available without comparing it to itself.
  *
  * C. Leslie, E. Eskin, and W. Noble. The spectrum kernel: a string kernel
  * for SVM protein classifica- tion.  In Proc. of Pacific Symposium on
@@ -27,28 +27,33 @@
  * @{
  */
 
-/* External variables */
-extern config_t cfg;
-
-/* Normalizations */
-static knorm_t n = KN_NONE;
-
-/* Local variables */
-static cfg_int len = 3;         /**< Length of k-mers */
+/**
+ * Sorted and run-length compressed k-mers of a string
+ */
+typedef struct
+{
+    int k;              /**< Length of k-mers */
+    int n;              /**< Number of distinct k-mers */
+    double norm;        /**< Kernel of the string with itself */
+    uint32_t *counts;   /**< Counts of k-mers */
+    uint64_t kmers[];   /**< Sorted hashes of k-mers */
+} spectrum_t;
 
 /**
  * Initializes the similarity measure
  */
-void kern_spectrum_config()
+void kern_spectrum_config(measures_t *self)
 {
+    assert (self);
+    measures_opts_t *opts = self->opts;
     const char *str;
 
     /* Length parameter */
-    config_lookup_int(&cfg, "measures.kern_spectrum.length", &len);
+    config_lookup_int(self->cfg, "measures.kern_spectrum.length", &opts->length);
 
     /* Normalization */
-    config_lookup_string(&cfg, "measures.kern_spectrum.norm", &str);
-    n = knorm_get(str);
+    config_lookup_string(self->cfg, "measures.kern_spectrum.norm", &str);
+    opts->knorm = knorm_get(str);
 }
 
 
@@ -68,75 +73,164 @@ static int cmp_uint64(const void *x, const void *y)
 }
 
 /**
- * Extract and sort k-mers in a string and return their hashes.
+ * Extracts, sorts and counts the k-mers of a string.
  * @param x string
- * @return array of sorted k-mer hashes
+ * @param k length of k-mers
+ * @return spectrum of string or NULL on error
  */
-static uint64_t *extract_kmers(hstring_t *x)
+static spectrum_t *spectrum_new(hstring_t *x, int k)
 {
-    assert(x->len - len + 1 >= 0);
-
-    int i;
+    int i, j, n = k > 0 && x->len >= k ? x->len - k + 1 : 0;
+    spectrum_t *s;
 
-    uint64_t *xh = (uint64_t *) zmalloc(x->len * sizeof(uint64_t));
-    if (!xh) {
+    s = malloc(sizeof(spectrum_t) + n * (sizeof(uint64_t) + sizeof(uint32_t)));
+    if (!s) {
         error("Could not allocate memory for spectrum kernel");
         return NULL;
     }
 
-    for (i = 0; i < x->len - len + 1; i++)
-        xh[i] = hstring_hash_sub(x, i, len);
+    for (i = 0; i < n; i++)
+        s->kmers[i] = hstring_hash_sub(x, i, k);
+    qsort(s->kmers, n, sizeof(uint64_t), cmp_uint64);
+
+    /* Run-length compression of sorted k-mers */
+    s->counts = (uint32_t *) (s->kmers + n);
+    for (i = 0, j = -1; i < n; i++) {
+        if (j >= 0 && s->kmers[j] == s->kmers[i]) {
+            s->counts[j]++;
+        } else {
+            s->kmers[++j] = s->kmers[i];
+            s->counts[j] = 1;
+        }
+    }
+
+    s->k = k;
+    s->n = j + 1;
+    s->norm = 0;
+    for (i = 0; i < s->n; i++)
+        s->norm += (double) s->counts[i] * s->counts[i];
+
+    return s;
+}
+
+/**
+ * Returns the spectrum of a string. The spectrum is computed once and
+ * attached to the string. If the string holds a spectrum for a different
+ * length of k-mers, a temporary spectrum is returned.
+ * @param x string
+ * @param k length of k-mers
+ * @param tmp set to true if the spectrum needs to be freed by the caller
+ * @return spectrum of string or NULL on error
+ */
+static spectrum_t *spectrum_get(hstring_t *x, int k, int *tmp)
+{
+    spectrum_t *s, *t;
+
+    *tmp = FALSE;
+    s = __atomic_load_n((spectrum_t **) &x->spec, __ATOMIC_ACQUIRE);
+    if (s && s->k == k)
+        return s;
 
-    qsort(xh, x->len - len + 1, sizeof(uint64_t), cmp_uint64);
-    return xh;
+    t = spectrum_new(x, k);
+    if (!t || s)
+        goto temporary;
+
+    /* Another thread may attach its spectrum first */
+    if (__atomic_compare_exchange_n((spectrum_t **) &x->spec, &s, t, FALSE,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        return t;
+    if (s->k == k) {
+        free(t);
+        return s;
+    }
+
+temporary:
+    *tmp = t != NULL;
+    return t;
+}
+
+/**
+ * Computes the inner product of two spectra by merging the sorted
+ * k-mers. If one spectrum is much smaller, its k-mers are searched in
+ * the larger one instead.
+ * @param a first spectrum
+ * @param b second spectrum
+ * @return inner product
+ */
+static double spectrum_dot(spectrum_t *a, spectrum_t *b)
+{
+    int i = 0, j = 0, lo, hi, mid;
+    uint64_t u, v;
+    spectrum_t *c;
+    double k = 0;
+
+    if (a->n > b->n) {
+        c = a;
+        a = b;
+        b = c;
+    }
+
+    if ((long) a->n * 16 < b->n) {
+        for (i = 0; i < a->n; i++) {
+            for (lo = j, hi = b->n; lo < hi;) {
+                mid = lo + (hi - lo) / 2;
+                if (b->kmers[mid] < a->kmers[i])
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            j = lo;
+            if (j == b->n)
+                break;
+            if (b->kmers[j] == a->kmers[i])
+                k += (double) a->counts[i] * b->counts[j];
+        }
+        return k;
+    }
+
+    /* Branch-free advance of the merge */
+    while (i < a->n && j < b->n) {
+        u = a->kmers[i];
+        v = b->kmers[j];
+        if (u == v)
+            k += (double) a->counts[i] * b->counts[j];
+        i += u <= v;
+        j += v <= u;
+    }
+    return k;
 }
 
 /**
  * Internal computation of spectrum kernel
  * @param x first string
  * @param y second string
+ * @param nx set to the kernel of x with itself (or NULL)
+ * @param ny set to the kernel of y with itself (or NULL)
  * @return spectrum kernel
  */
-static float kernel(measures_t *self, hstring_t *x, hstring_t *y)
+static float kernel(measures_t *self, hstring_t *x, hstring_t *y,
+                    double *nx, double *ny)
 {
-    float k = 0;
-    int i = 0, j = 0;
-
-    /* Check for small strings */
-    if (x->len < len || y->len < len)
-        return 0;
-
-    /* Extract k-mers */
-    uint64_t *xh = extract_kmers(x);
-    uint64_t *yh = extract_kmers(y);
-
-    while(i < x->len - len + 1 && j < y->len - len + 1) {
-        if (xh[i] < yh[j]) {
-            i++;
-        } else if (xh[i] > yh[j]) {
-            j++;
-        } else {
-            float xn = 0;
-            while(xh[i] == yh[j]) {
-                i++;
-                xn++;
-            }
+    int k = self->opts->length, tx, ty;
+    spectrum_t *sx, *sy;
+    double d = 0;
 
-            float yn = 0;
-            while(xh[i - 1] == yh[j]) {
-                j++;
-                yn++;
-            }
+    sx = spectrum_get(x, k, &tx);
+    sy = spectrum_get(y, k, &ty);
 
-            k += xn * yn;
-        }
+    if (sx && sy) {
+        d = spectrum_dot(sx, sy);
+        if (nx)
+            *nx = sx->norm;
+        if (ny)
+            *ny = sy->norm;
     }
 
-    /* Free space */
-    free(xh);
-    free(yh);
-
-    return k;
+    if (tx)
+        free(sx);
+    if (ty)
+        free(sy);
+    return d;
 }
 
 /**
@@ -148,8 +242,13 @@ static float kernel(measures_t *self, hstring_t *x, hstring_t *y)
 float kern_spectrum_compare(measures_t *self, hstring_t *x, hstring_t *y)
 {
     assert (self);
-    float k = kernel(self, x, y);
-    return knorm(self, k, x, y, kernel);
+    double nx = 0, ny = 0;
+    float k = kernel(self, x, y, &nx, &ny);
+
+    /* Norms are part of the spectra */
+    if (self->opts->knorm == KN_L2)
+        return k / sqrt(nx * ny);
+    return k;
 }
 
 
@@ -157,9 +256,111 @@ float kern_spectrum_compare(measures_t *self, hstring_t *x, hstring_t *y)
 //  Self test of this class
 
 
+/*
+ * Structure for testing string kernels/distances
+ */
+struct hstring_test
+{
+    char *x;            /**< String x */
+    char *y;            /**< String y */
+    int len;            /**< Length of k-mers */
+    float v;            /**< Expected output */
+};
+
+static struct hstring_test tests[] = {
+    {"", "", 3, 0},
+    {"ab", "ab", 3, 0},
+    {"abc", "abc", 3, 1},
+    {"abcabc", "abc", 3, 2},
+    {"abcabc", "abcabc", 3, 6},
+    {"aaaa", "aaa", 2, 6},
+    {"abab", "baba", 1, 8},
+    {"abcd", "dcba", 2, 0},
+    {NULL}
+};
+
 void
 kern_spectrum_test (bool verbose)
 {
-    printf (" * kern_spectrum: SKIP.\n");
+    printf (" * Spectrum kernel:");
+
+    //  @selftest
+    int i, j, err = FALSE;
+    hstring_t *x, *y;
+    measures_t *spectrum = measures_new ("kern_spectrum");
+    assert (spectrum);
+
+    for (i = 0; tests[i].x && !err; i++) {
+        measures_config_set_int (spectrum, "measures.kern_spectrum.length",
+                                 tests[i].len);
+        x = hstring_new (tests[i].x);
+        y = hstring_new (tests[i].y);
+        hstring_preproc (x, spectrum);
+        hstring_preproc (y, spectrum);
+
+        float k = measures_compare (spectrum, x, y);
+        if (fabs (tests[i].v - k) > 1e-6) {
+            printf ("Error %f != %f\n", k, tests[i].v);
+            hstring_print (x);
+            hstring_print (y);
+            err = TRUE;
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
+
+    //  Compare with counting of k-mers by pairs of positions
+    char a[400], b[400];
+    srand (1234);
+    measures_config_set_int (spectrum, "measures.kern_spectrum.length", 3);
+
+    for (i = 0; i < 100 && !err; i++) {
+        //  Every tenth pair is a long string and a short substring of it
+        int n = i % 10 ? rand () % 40 : 200 + rand () % 200;
+        int m = i % 10 ? rand () % 40 : rand () % 8;
+        for (j = 0; j < n; j++)
+            a[j] = 'a' + rand () % (i % 10 ? 3 : 26);
+        for (j = 0; j < m; j++)
+            b[j] = i % 10 ? 'a' + rand () % 3 : a[j + n / 2];
+        a[n] = b[m] = 0;
+
+        x = hstring_new (a);
+        y = hstring_new (b);
+
+        float v = 0, nx = 0, ny = 0;
+        for (j = 0; j + 3 <= n; j++)
+            for (int l = 0; l + 3 <= m; l++)
+                v += !strncmp (a + j, b + l, 3);
+        for (j = 0; j + 3 <= n; j++)
+            for (int l = 0; l + 3 <= n; l++)
+                nx += !strncmp (a + j, a + l, 3);
+        for (j = 0; j + 3 <= m; j++)
+            for (int l = 0; l + 3 <= m; l++)
+                ny += !strncmp (b + j, b + l, 3);
+
+        //  Second comparison uses the attached spectra and the L2 norm
+        float k1 = measures_compare (spectrum, x, y);
+        measures_config_set_string (spectrum, "measures.kern_spectrum.norm",
+                                    "l2");
+        float k2 = measures_compare (spectrum, y, x);
+        measures_config_set_string (spectrum, "measures.kern_spectrum.norm",
+                                    "none");
+
+        if (fabs (k1 - v) > 1e-5 ||
+            (nx * ny > 0 && fabs (k2 - v / sqrt (nx * ny)) > 1e-5)) {
+            printf ("Error %f, %f != %f\n", k1, k2, v);
+            err = TRUE;
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
+
+    measures_destroy (&spectrum);
+    assert (!err);
+    //  @end
+
+    printf (" OK\n");
 }
 /** @} */
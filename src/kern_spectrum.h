@@ -13,7 +13,7 @@
 #define KERN_SPECTRUM_H
 
 /* Module interface */
-void kern_spectrum_config();
+void kern_spectrum_config(measures_t *);
 float kern_spectrum_compare(measures_t *, hstring_t *, hstring_t *);
 void kern_spectrum_test (bool verbose);
 
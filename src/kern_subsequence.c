@@ -16,105 +16,313 @@
  * <hr>
  * <em>kern_subsequence</em>: Subsequence kernel
  *
+ * The kernel is computed row by row over x. For each length of
+ * subsequences only two rows of the dynamic program are kept, and the
+ * positions of y matching a symbol of x are taken from a sorted list
+ * of the symbols of y. Memory is linear in the length of y and taken
+ * from the per-thread scratch memory of the measure.
+ *
+ * If few positions match, for example for tokens, only the matches are
+ * visited (Rousu and Shawe-Taylor). The decayed sums over the previous
+ * matches are kept in a Fenwick tree over the positions of y, whose
+ * nodes are stored relative to their last row and position, such that
+ * only powers of lambda below one occur.
+ *
  * Lodhi, Saunders, Shawe-Taylor, Cristianini, and Watkins. Text
  * classification using string kernels. Journal of Machine Learning
  * Research, 2:419-444, 2002.
+ *
+ * Rousu and Shawe-Taylor. Efficient computation of gapped substring
+ * kernels on large alphabets. Journal of Machine Learning Research,
+ * 6:1323-1344, 2005.
  * @{
  */
 
-/* External variables */
-extern config_t cfg;
+/**
+ * Occurrence of a symbol in y
+ */
+typedef struct
+{
+    sym_t sym;          /**< Symbol */
+    int pos;            /**< Position in y */
+} occur_t;
 
-/* Normalizations */
-static knorm_t n = KN_NONE;
+/**
+ * Node of a Fenwick tree over the positions of y
+ */
+typedef struct
+{
+    double sum;         /**< Decayed sum relative to row and last position */
+    int row;            /**< Row of last update */
+} node_t;
 
-/* Local variables */
-static cfg_int length = 3;     /**< Maximum length */
-static double lambda = 0.1;    /**< Weight for gaps */
+/** Variants of the dynamic program */
+enum { SSK_AUTO, SSK_DENSE, SSK_SPARSE };
 
 /**
  * Initializes the similarity measure
  */
-void kern_subsequence_config()
+void kern_subsequence_config(measures_t *self)
 {
+    assert (self);
+    measures_opts_t *opts = self->opts;
     const char *str;
 
-    config_lookup_int(&cfg, "measures.kern_subsequence.length", &length);
-    config_lookup_float(&cfg, "measures.kern_subsequence.lambda", &lambda);
+    config_lookup_int(self->cfg, "measures.kern_subsequence.length", &opts->length);
+    config_lookup_float(self->cfg, "measures.kern_subsequence.lambda", &opts->lambda);
 
     /* Normalization */
-    config_lookup_string(&cfg, "measures.kern_subsequence.norm", &str);
-    n = knorm_get(str);
+    config_lookup_string(self->cfg, "measures.kern_subsequence.norm", &str);
+    opts->knorm = knorm_get(str);
 }
 
+/**
+ * Compares two occurrences of symbols
+ * @param x first occurrence
+ * @param y second occurrence
+ * @return result as a signed integer
+ */
+static int cmp_occur(const void *x, const void *y)
+{
+    const occur_t *a = (const occur_t *) x, *b = (const occur_t *) y;
 
-/* Ugly macros to access arrays */
-#define DP(i,j)     dp[(i) * (y->len + 1) + (j)]
-#define DPS(i,j)    dps[(i) * y->len + (j)]
+    if (a->sym != b->sym)
+        return a->sym > b->sym ? +1 : -1;
+    return a->pos - b->pos;
+}
 
 /**
- * Internal computation of subsequence kernel
+ * Returns the first occurrence of a symbol in a sorted list
+ * @param m sorted occurrences
+ * @param n number of occurrences
+ * @param s symbol
+ * @return index of first entry with symbol or n if there is none
+ */
+static int find_occur(occur_t *m, int n, sym_t s)
+{
+    int lo = 0, hi = n, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (m[mid].sym < s)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < n && m[lo].sym == s ? lo : n;
+}
+
+/**
+ * Returns the number of occurrences of a symbol in a sorted list
+ * @param m sorted occurrences
+ * @param n number of occurrences
+ * @param s symbol
+ * @return number of entries with symbol
+ */
+static int count_occur(occur_t *m, int n, sym_t s)
+{
+    int first = find_occur(m, n, s), lo = first, hi = n, mid;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (m[mid].sym <= s)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo - first;
+}
+
+/**
+ * Computes the subsequence kernel with two rows of the dynamic program
+ * per length. The cells are computed in the same order and with the same
+ * operations as in the formulation with two full matrices.
  * @param x first string
  * @param y second string
+ * @param my sorted occurrences of the symbols of y
  * @return subsequence kernel
  */
-static float kernel(measures_t *self, hstring_t *x, hstring_t *y)
+static float ssk_dense(measures_t *self, hstring_t *x, hstring_t *y,
+                       occur_t *my)
 {
-    float *dps, *dp;
-    float kern[length];
-    int i, j, l;
-
-    /* Case a: both sequences empty */
-    if (x->len == 0 && y->len == 0)
-        return 1.0;
-
-    /* Case b: one sequence empty */
-    if (x->len == 0 || y->len == 0)
-        return 0.0;
+    double lambda = self->opts->lambda;
+    int i, j, l, t, length = self->opts->length, m = y->len;
+    float *dp, *prev, *cur, *pl, s, kern[length];
 
-    /* Allocate temporary memory */
-    dp = (float *) zmalloc(sizeof(float) * (x->len + 1) * (y->len + 1));
-    dps = (float *) zmalloc(sizeof(float) * x->len * y->len);
-    if (!dp || !dps) {
+    dp = measures_alloc(self, sizeof(float) * 2 * length * (m + 1));
+    if (!dp) {
         error("Could not allocate memory for subsequence kernel");
         return 0;
     }
 
-    /* Initalize dps */
-    for (i = 0; i < x->len; i++)
-        for (j = 0; j < y->len; j++) {
-            if (!hstring_compare(x, i, y, j))
-                DPS(i,j) = lambda * lambda;
-            else
-                DPS(i,j) = 0;
+    /* Two rows per length alternate between previous and current */
+    memset(dp, 0, sizeof(float) * 2 * length * (m + 1));
+    for (l = 0; l < length; l++)
+        kern[l] = 0;
+
+    for (i = 0; i < x->len; i++) {
+        /* Positions of y matching the symbol of x */
+        int first = find_occur(my, m, hstring_get(x, i)), last = first;
+        while (last < m && my[last].sym == my[first].sym)
+            last++;
+
+        for (l = 0; l < length; l++) {
+            prev = dp + (2 * l + i % 2) * (m + 1);
+            cur = dp + (2 * l + 1 - i % 2) * (m + 1);
+            pl = l > 0 ? prev - 2 * (m + 1) : NULL;
+
+            for (j = 0, t = first; j < m; j++) {
+                s = 0;
+                if (t < last && my[t].pos == j) {
+                    s = l > 0 ? lambda * lambda * pl[j] : lambda * lambda;
+                    kern[l] = kern[l] + s;
+                    t++;
+                }
+                cur[j + 1] = s + lambda * prev[j + 1] +
+                    lambda * cur[j] - lambda * lambda * prev[j];
+            }
         }
+    }
 
-    /* Initialize dp */
-    for (i = 0; i < x->len + 1; i++)
-        DP(i, 0) = 0;
-    for (j = 0; j < y->len + 1; j++)
-        DP(0, j) = 0;
+    measures_release(self, dp);
+    return kern[length - 1];
+}
 
-    for (l = 0; l < length; l++) {
+/**
+ * Computes the subsequence kernel over the matching positions only. A
+ * match (i, j) of length l contributes lambda^2 times the sum of the
+ * contributions of length l - 1 of all matches (i', j') with i' < i and
+ * j' < j, decayed by lambda^(i - 1 - i' + j - 1 - j'). Matches of a row
+ * are visited by decreasing position, such that the tree holds previous
+ * rows only when it is queried.
+ * @param x first string
+ * @param y second string
+ * @param my sorted occurrences of the symbols of y
+ * @return subsequence kernel
+ */
+static float ssk_sparse(measures_t *self, hstring_t *x, hstring_t *y,
+                        occur_t *my)
+{
+    double lambda = self->opts->lambda, q, c[self->opts->length];
+    double kern[self->opts->length];
+    int i, j, k, l, t, length = self->opts->length, m = y->len;
+    int n = MAX(x->len, m) + 1;
+    node_t *tree, *nd;
+    double *pw;
+
+    /* Fenwick tree per length and powers of lambda */
+    tree = measures_alloc(self, sizeof(node_t) * length * (m + 1) +
+                          sizeof(double) * n);
+    if (!tree) {
+        error("Could not allocate memory for subsequence kernel");
+        return 0;
+    }
+    pw = (double *) (tree + length * (m + 1));
+    memset(tree, 0, sizeof(node_t) * length * (m + 1));
+    for (k = 0, q = 1; k < n; k++, q *= lambda)
+        pw[k] = q;
+    for (l = 0; l < length; l++)
         kern[l] = 0;
-        for (i = 0; i < x->len; i++) {
-            for (j = 0; j < y->len; j++) {
-                DP(i + 1, j + 1) = DPS(i,j) + lambda * DP(i, j + 1) +
-                    lambda * DP(i + 1, j) - lambda * lambda * DP(i, j);
-                if (!hstring_compare(x, i, y, j)) {
-                    kern[l] = kern[l] + DPS(i,j);
-                    DPS(i,j) = lambda * lambda * DP(i, j);
+
+    /* Rows and positions start at 1 */
+    for (i = 1; i <= x->len; i++) {
+        int first = find_occur(my, m, hstring_get(x, i - 1)), last = first;
+        while (last < m && my[last].sym == my[first].sym)
+            last++;
+
+        for (t = last - 1; t >= first; t--) {
+            j = my[t].pos + 1;
+            c[0] = lambda * lambda;
+            for (l = 1; l < length; l++) {
+                q = 0;
+                for (k = j - 1; k > 0; k -= k & -k) {
+                    nd = tree + (l - 1) * (m + 1) + k;
+                    q += nd->sum * pw[i - 1 - nd->row] * pw[j - 1 - k];
+                }
+                c[l] = lambda * lambda * q;
+            }
+
+            for (l = 0; l < length; l++) {
+                kern[l] += c[l];
+                for (k = j; k <= m; k += k & -k) {
+                    nd = tree + l * (m + 1) + k;
+                    nd->sum = nd->sum * pw[i - nd->row] + c[l] * pw[k - j];
+                    nd->row = i;
                 }
             }
         }
     }
 
-    free(dps);
-    free(dp);
-
+    measures_release(self, tree);
     return kern[length - 1];
 }
 
+/**
+ * Internal computation of subsequence kernel. The matching positions are
+ * visited if an update of the tree per match costs less than computing
+ * all cells of the dynamic program. An update of one level of the tree
+ * takes about half the time of a cell.
+ * @param x first string
+ * @param y second string
+ * @param mode variant of the dynamic program
+ * @return subsequence kernel
+ */
+static float subsequence(measures_t *self, hstring_t *x, hstring_t *y,
+                         int mode)
+{
+    int i, j, m = y->len, depth = 1;
+    long matches = 0;
+    occur_t *my;
+    float k;
+
+    /* Case a: both sequences empty */
+    if (x->len == 0 && y->len == 0)
+        return 1.0;
+
+    /* Case b: one sequence empty */
+    if (x->len == 0 || y->len == 0 || self->opts->length < 1)
+        return 0.0;
+
+    /* Sorted symbols of y */
+    my = measures_alloc(self, sizeof(occur_t) * m);
+    if (!my) {
+        error("Could not allocate memory for subsequence kernel");
+        return 0;
+    }
+    for (j = 0; j < m; j++) {
+        my[j].sym = hstring_get(y, j);
+        my[j].pos = j;
+    }
+    qsort(my, m, sizeof(occur_t), cmp_occur);
+
+    if (mode == SSK_AUTO) {
+        for (i = 0; i < x->len; i++)
+            matches += count_occur(my, m, hstring_get(x, i));
+        while ((1 << depth) <= m)
+            depth++;
+        mode = matches * depth < 2L * x->len * m ? SSK_SPARSE : SSK_DENSE;
+    }
+
+    if (mode == SSK_SPARSE)
+        k = ssk_sparse(self, x, y, my);
+    else
+        k = ssk_dense(self, x, y, my);
+
+    measures_release(self, my);
+    return k;
+}
+
+/**
+ * Internal computation of subsequence kernel
+ * @param x first string
+ * @param y second string
+ * @return subsequence kernel
+ */
+static float kernel(measures_t *self, hstring_t *x, hstring_t *y)
+{
+    return subsequence(self, x, y, SSK_AUTO);
+}
+
 /**
  * Compute the subsequence kernel by Lodhi et al. (2002). The implementation
  * has been taken from the book by Cristianini & Shawe-Taylor.
@@ -134,9 +342,171 @@ float kern_subsequence_compare(measures_t *self, hstring_t *x, hstring_t *y)
 //  Self test of this class
 
 
+/*
+ * Formulation with two full matrices by Cristianini & Shawe-Taylor
+ */
+static float
+ssk_full (measures_t *self, hstring_t *x, hstring_t *y)
+{
+    double lambda = self->opts->lambda;
+    int i, j, l, length = self->opts->length, m = y->len;
+    float kern[length], *dp, *dps;
+
+    if (x->len == 0 && y->len == 0)
+        return 1.0;
+    if (x->len == 0 || y->len == 0)
+        return 0.0;
+
+    dp = (float *) zmalloc (sizeof (float) * (x->len + 1) * (m + 1));
+    dps = (float *) zmalloc (sizeof (float) * x->len * m);
+
+    for (i = 0; i < x->len; i++)
+        for (j = 0; j < m; j++)
+            dps[i * m + j] = hstring_compare (x, i, y, j) ? 0 : lambda * lambda;
+
+    for (l = 0; l < length; l++) {
+        kern[l] = 0;
+        for (i = 0; i < x->len; i++) {
+            for (j = 0; j < m; j++) {
+                dp[(i + 1) * (m + 1) + j + 1] = dps[i * m + j] +
+                    lambda * dp[i * (m + 1) + j + 1] +
+                    lambda * dp[(i + 1) * (m + 1) + j] -
+                    lambda * lambda * dp[i * (m + 1) + j];
+                if (!hstring_compare (x, i, y, j)) {
+                    kern[l] = kern[l] + dps[i * m + j];
+                    dps[i * m + j] = lambda * lambda * dp[i * (m + 1) + j];
+                }
+            }
+        }
+    }
+
+    free (dps);
+    free (dp);
+    return kern[length - 1];
+}
+
+/*
+ * Structure for testing string kernels/distances
+ */
+struct hstring_test
+{
+    char *x;            /**< String x */
+    char *y;            /**< String y */
+    int len;            /**< Length of subsequences */
+    float v;            /**< Expected output */
+};
+
+static struct hstring_test tests[] = {
+    {"", "", 3, 1},
+    {"a", "", 3, 0},
+    {"a", "a", 1, 0.01},
+    {"ab", "ab", 2, 0.0001},
+    {"ab", "axb", 2, 0.00001},
+    {"ab", "ba", 2, 0},
+    {NULL}
+};
+
 void
 kern_subsequence_test (bool verbose)
 {
-    printf (" * kern_subsequence: SKIP.\n");
+    printf (" * Subsequence kernel:");
+
+    //  @selftest
+    int i, j, err = FALSE;
+    hstring_t *x, *y;
+    measures_t *ssk = measures_new ("kern_subsequence");
+    assert (ssk);
+
+    for (i = 0; tests[i].x && !err; i++) {
+        measures_config_set_int (ssk, "measures.kern_subsequence.length",
+                                 tests[i].len);
+        x = hstring_new (tests[i].x);
+        y = hstring_new (tests[i].y);
+        hstring_preproc (x, ssk);
+        hstring_preproc (y, ssk);
+
+        float k = measures_compare (ssk, x, y);
+        if (fabs (tests[i].v - k) > 1e-9) {
+            printf ("Error %g != %g\n", k, tests[i].v);
+            hstring_print (x);
+            hstring_print (y);
+            err = TRUE;
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
+
+    //  Compare row-wise and full dynamic program
+    char a[100], b[100];
+    const char *gran[] = {"bytes", "tokens"};
+    hstring_delim_set (".");
+    srand (1234);
+
+    for (i = 0; i < 200 && !err; i++) {
+        int n = rand () % 100, m = rand () % 100;
+        for (j = 0; j < n; j++)
+            a[j] = '.' + rand () % 5;
+        for (j = 0; j < m; j++)
+            b[j] = '.' + rand () % 5;
+        a[n] = b[m] = 0;
+
+        measures_config_set_string (ssk, "measures.granularity", gran[i % 2]);
+        measures_config_set_int (ssk, "measures.kern_subsequence.length",
+                                 1 + i % 5);
+        measures_config_set_float (ssk, "measures.kern_subsequence.lambda",
+                                   i % 3 ? 0.5 : 0.1);
+        x = hstring_new (a);
+        y = hstring_new (b);
+        hstring_preproc (x, ssk);
+        hstring_preproc (y, ssk);
+
+        float k1 = subsequence (ssk, x, y, SSK_DENSE);
+        float k2 = ssk_full (ssk, x, y);
+        float k3 = subsequence (ssk, x, y, SSK_SPARSE);
+        if (k1 != k2 || fabs (k3 - k2) > 1e-4 * fabs (k2) + 1e-30) {
+            printf ("Error %g != %g, %g\n", k1, k2, k3);
+            err = TRUE;
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
+
+    //  Sparse matches of long token strings
+    char *c = malloc (20001), *d = malloc (20001);
+    measures_config_set_string (ssk, "measures.granularity", "tokens");
+    measures_config_set_int (ssk, "measures.kern_subsequence.length", 3);
+    for (i = 0; i < 20 && !err; i++) {
+        for (j = 0; j < 20000; j++) {
+            c[j] = j % 4 == 3 ? '.' : 'a' + rand () % 10;
+            d[j] = j % 4 == 3 ? '.' : 'a' + rand () % 10;
+        }
+        c[20000] = d[20000] = 0;
+        measures_config_set_float (ssk, "measures.kern_subsequence.lambda",
+                                   i % 2 ? 0.5 : 0.9);
+        x = hstring_new (c + rand () % 10000);
+        y = hstring_new (d + rand () % 10000);
+        hstring_preproc (x, ssk);
+        hstring_preproc (y, ssk);
+
+        float k1 = subsequence (ssk, x, y, SSK_DENSE);
+        float k2 = kernel (ssk, x, y);
+        if (fabs (k1 - k2) > 1e-4 * fabs (k1) + 1e-30) {
+            printf ("Error %g != %g\n", k1, k2);
+            err = TRUE;
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
+    free (c);
+    free (d);
+
+    measures_destroy (&ssk);
+    assert (!err);
+    //  @end
+
+    printf (" OK\n");
 }
 /** @} */
@@ -13,7 +13,7 @@
 #define KERN_SUBSEQUENCE_H
 
 /* Module interface */
-void kern_subsequence_config();
+void kern_subsequence_config(measures_t *);
 float kern_subsequence_compare(measures_t *, hstring_t *, hstring_t *);
 void kern_subsequence_test (bool verbose);
 
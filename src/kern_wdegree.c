@@ -66,9 +66,12 @@ static float weight(float len, int degree)
  * @param xs Shift for x
  * @param ys Shift for y
  * @param len Length of region to match
+ * @param type String type
  * @return kernel value
  */
-static float kern_wdegree(measures_t *self, hstring_t *x, hstring_t *y, int xs, int ys, int len)
+HSTRING_INLINE float
+kern_wdegree(measures_t *self, hstring_t *x, hstring_t *y, int xs, int ys,
+             int len, const unsigned int type)
 {
     measures_opts_t *opts = self->opts;
     int i, start;
@@ -76,7 +79,7 @@ static float kern_wdegree(measures_t *self, hstring_t *x, hstring_t *y, int xs,
 
     for (i = 0, start = -1; i < len; i++) {
         /* Identify matching region */
-        if (!hstring_compare(x, i + xs, y, i + ys)) {
+        if (hstring_equal(x, i + xs, y, i + ys, type)) {
             if (start == -1)
                 start = i;
             continue;
@@ -100,9 +103,12 @@ static float kern_wdegree(measures_t *self, hstring_t *x, hstring_t *y, int xs,
  * Internal computation of weighted-degree kernel with shift
  * @param x first string
  * @param y second string
+ * @param type string type
  * @return weighted-degree kernel
  */
-static float kernel(measures_t *self, hstring_t *x, hstring_t *y)
+HSTRING_INLINE float
+kernel_shift(measures_t *self, hstring_t *x, hstring_t *y,
+             const unsigned int type)
 {
     measures_opts_t *opts = self->opts;
     float k = 0;
@@ -112,16 +118,29 @@ static float kernel(measures_t *self, hstring_t *x, hstring_t *y)
     for (s = -opts->shift; s <= opts->shift; s++) {
         if (s <= 0) {
             len = fmax(fmin(x->len, y->len + s), 0);
-            k += kern_wdegree(self, x, y, 0, -s, len);
+            k += kern_wdegree(self, x, y, 0, -s, len, type);
         } else {
             len = fmax(fmin(x->len - s, y->len), 0);
-            k += kern_wdegree(self, x, y, +s, 0, len);
+            k += kern_wdegree(self, x, y, +s, 0, len, type);
         }
     }
 
     return k;
 }
 
+/**
+ * Internal computation of weighted-degree kernel
+ * @param x first string
+ * @param y second string
+ * @return weighted-degree kernel
+ */
+static float kernel(measures_t *self, hstring_t *x, hstring_t *y)
+{
+    float k;
+    HSTRING_SPECIALIZE(k, x->type, kernel_shift, self, x, y);
+    return k;
+}
+
 
 /**
  * Compute the weighted-degree kernel with shift. If the strings have
@@ -29,21 +29,31 @@ measures_func_t func[] = {
     {"dist_bag", dist_bag_config, dist_bag_compare},
     {"dist_compression", dist_compression_config, dist_compression_compare},
     {"dist_ncd", dist_compression_config, dist_compression_compare},
-    {"dist_damerau", dist_damerau_config, dist_damerau_compare},
+    {"dist_damerau", dist_damerau_config, dist_damerau_compare,
+        MEASURES_QUADRATIC},
     {"dist_hamming", dist_hamming_config, dist_hamming_compare},
-    {"dist_jaro", dist_jaro_config, dist_jaro_compare},
-    {"dist_jarowinkler", dist_jarowinkler_config, dist_jarowinkler_compare},
+    {"dist_jaro", dist_jaro_config, dist_jaro_compare,
+        MEASURES_QUADRATIC},
+    {"dist_jarowinkler", dist_jarowinkler_config, dist_jarowinkler_compare,
+        MEASURES_QUADRATIC},
     {"dist_kernel", dist_kernel_config, dist_kernel_compare},
     {"dist_lee", dist_lee_config, dist_lee_compare},
-    {"dist_levenshtein", dist_levenshtein_config, dist_levenshtein_compare},
-    {"dist_edit", dist_levenshtein_config, dist_levenshtein_compare},
-    {"dist_osa", dist_osa_config, dist_osa_compare},
-    {"kern_distance", kern_distance_config, kern_distance_compare},
-    {"kern_dsk", kern_distance_config, kern_distance_compare},
+    {"dist_levenshtein", dist_levenshtein_config, dist_levenshtein_compare,
+        MEASURES_QUADRATIC},
+    {"dist_edit", dist_levenshtein_config, dist_levenshtein_compare,
+        MEASURES_QUADRATIC},
+    {"dist_osa", dist_osa_config, dist_osa_compare,
+        MEASURES_QUADRATIC},
+    {"kern_distance", kern_distance_config, kern_distance_compare,
+        MEASURES_QUADRATIC},
+    {"kern_dsk", kern_distance_config, kern_distance_compare,
+        MEASURES_QUADRATIC},
     {"kern_spectrum", kern_spectrum_config, kern_spectrum_compare},
     {"kern_ngram", kern_spectrum_config, kern_spectrum_compare},
-    {"kern_subsequence", kern_subsequence_config, kern_subsequence_compare},
-    {"kern_ssk", kern_subsequence_config, kern_subsequence_compare},
+    {"kern_subsequence", kern_subsequence_config, kern_subsequence_compare,
+        MEASURES_QUADRATIC},
+    {"kern_ssk", kern_subsequence_config, kern_subsequence_compare,
+        MEASURES_QUADRATIC},
     {"kern_wdegree", kern_wdegree_config, kern_wdegree_compare},
     {"kern_wdk", kern_wdegree_config, kern_wdegree_compare},
     {"sim_braun", sim_braun_config, sim_braun_compare},
@@ -60,6 +70,237 @@ measures_func_t func[] = {
 };
 
 
+//  --------------------------------------------------------------------------
+//  Aggregates the number of pairs that reached a stage of the prefilter
+//  cascade over all threads.
+
+static uint64_t
+prefilter_count (measures_t *self, int stage)
+{
+    uint64_t n = 0;
+    for (int i = 0; i < VCACHE_THREADS; i++)
+        n += __atomic_load_n (&self->prefilter_stats[i][stage],
+                              __ATOMIC_RELAXED);
+    return n;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Determines the minimum cost of an edit operation changing the bag of
+//  symbols. Transpositions keep the bag. Returns 0 if the measure is not
+//  supported by the prefilter cascade.
+
+static double
+prefilter_cost (measures_t *self)
+{
+    measures_opts_t *opts = self->opts;
+    measures_compare_fn *fn = self->func->measure_compare;
+    double c = fmin (fmin (opts->cost_ins, opts->cost_del), opts->cost_sub);
+
+    if (fn == dist_levenshtein_compare)
+        return c;
+    //  OSA and Damerau truncate costs to integers
+    if (fn == dist_osa_compare)
+        return floor (c);
+    //  Symbols skipped by transpositions are deleted at cost 1
+    if (fn == dist_damerau_compare)
+        return fmin (floor (c), 1.0);
+    return 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Runs the cheap stages of the prefilter cascade: the length difference
+//  and the bag distance of the signatures lower bound the edit distance.
+//  Returns true and a lower bound beyond the cutoff if the pair is pruned.
+
+static int
+prefilter_prune (measures_t *self, hstring_t *x, hstring_t *y, float *m)
+{
+    //  Threads beyond the slots share the first one
+    uint64_t *stats = self->prefilter_stats[MAX (vcache_thread_slot (), 0)];
+    int i, d, pos = 0, neg = 0, stage = PREFILTER_FULL;
+
+    //  Stage 1: difference of lengths
+    *m = self->prefilter_cost * abs (x->len - y->len);
+    if (*m > self->prefilter) {
+        stage = PREFILTER_LENGTH;
+    } else if (x->bag_len == x->len && y->bag_len == y->len) {
+        //  Stage 2: bag distance of signatures
+        for (i = 0; i < HSTRING_BAG; i++) {
+            d = x->bag[i] - y->bag[i];
+            if (d > 0)
+                pos += d;
+            else
+                neg -= d;
+        }
+        *m = self->prefilter_cost * MAX (pos, neg);
+        if (*m > self->prefilter)
+            stage = PREFILTER_BAG;
+    }
+
+    __atomic_fetch_add (&stats[stage], 1, __ATOMIC_RELAXED);
+    return stage != PREFILTER_FULL;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Returns the slot for per-thread state of the measure. Threads beyond
+//  the number of slots get NULL and need to use temporary state.
+
+void **
+measures_local (measures_t *self)
+{
+    int i = vcache_thread_slot ();
+    return i < 0 ? NULL : &self->local[i];
+}
+
+
+//  --------------------------------------------------------------------------
+//  Per-thread scratch memory, padded to a cache line. Allocations that
+//  spill to the heap carry a header linking them in reverse order.
+
+#define SCRATCH_ALIGN   16
+
+struct _scratch_t
+{
+    char *buf;          // Block of memory
+    size_t size;        // Size of block
+    size_t used;        // Bytes of block in use
+    size_t need;        // Largest number of bytes in use
+    void **spill;       // Last allocation spilled to the heap
+    size_t spilled;     // Bytes spilled to the heap
+    uint64_t heap;      // Number of heap allocations
+    char pad[8];
+};
+
+static struct _scratch_t *
+scratch_get (measures_t *self)
+{
+    int i = vcache_thread_slot ();
+    return i < 0 ? NULL : &self->scratch[i];
+}
+
+
+//  --------------------------------------------------------------------------
+//  Allocates scratch memory for the calling thread. Returns NULL if memory
+//  is exhausted.
+
+void *
+measures_alloc (measures_t *self, size_t size)
+{
+    struct _scratch_t *s = scratch_get (self);
+    void **p;
+
+    size = size ? (size + SCRATCH_ALIGN - 1) & ~(size_t) (SCRATCH_ALIGN - 1)
+                : SCRATCH_ALIGN;
+    if (!s)
+        return malloc (size);
+
+    //  Allocations spill until everything is released
+    if (!s->spill && s->used + size <= s->size) {
+        p = (void **) (s->buf + s->used);
+        s->used += size;
+    } else {
+        p = (void **) malloc (size + SCRATCH_ALIGN);
+        if (!p)
+            return NULL;
+        p[0] = s->spill;
+        p[1] = (void *) size;
+        s->spill = p;
+        s->spilled += size;
+        s->heap++;
+        p = (void **) ((char *) p + SCRATCH_ALIGN);
+    }
+
+    s->need = MAX (s->need, s->used + s->spilled);
+    return p;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Releases scratch memory of the calling thread together with all later
+//  allocations. The block grows to the largest use once all memory is
+//  released.
+
+void
+measures_release (measures_t *self, void *ptr)
+{
+    struct _scratch_t *s = scratch_get (self);
+    void **p;
+    int hit;
+
+    if (!ptr)
+        return;
+    if (!s) {
+        free (ptr);
+        return;
+    }
+
+    //  Spilled allocations are the latest ones
+    while (s->spill) {
+        p = s->spill;
+        s->spill = p[0];
+        s->spilled -= (size_t) p[1];
+        hit = (char *) p + SCRATCH_ALIGN == (char *) ptr;
+        free (p);
+        if (hit)
+            goto done;
+    }
+
+    assert ((char *) ptr >= s->buf && (char *) ptr < s->buf + s->size);
+    s->used = (char *) ptr - s->buf;
+
+done:
+    if (s->used == 0 && !s->spill && s->need > s->size) {
+        free (s->buf);
+        s->buf = malloc (s->need);
+        s->size = s->buf ? s->need : 0;
+        s->heap++;
+    }
+}
+
+
+//  --------------------------------------------------------------------------
+//  Counts a heap allocation of the calling thread in a measure
+
+void
+measures_heap_inc (measures_t *self)
+{
+    struct _scratch_t *s = scratch_get (self);
+    if (s)
+        s->heap++;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Returns the number of heap allocations of scratch memory
+
+uint64_t
+measures_heap (measures_t *self)
+{
+    uint64_t n = 0;
+    for (int i = 0; i < VCACHE_THREADS; i++)
+        n += self->scratch[i].heap;
+    return n;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Frees the per-thread state of the measure, for example, if the
+//  configuration changes.
+
+static void
+measures_local_free (measures_t *self)
+{
+    for (int i = 0; i < VCACHE_THREADS; i++) {
+        if (self->local[i])
+            self->local_free (self->local[i]);
+        self->local[i] = NULL;
+    }
+}
+
+
 //  --------------------------------------------------------------------------
 //  Creates a new measures instance for the given measure function. Return a
 //  measures instance initialized with measure function default values or NULL
@@ -75,6 +316,16 @@ measures_new (const char *name)
     int rc = 0;
     measures_t *self = (measures_t *) zmalloc (sizeof (measures_t));
     self->opts = (measures_opts_t *) zmalloc (sizeof (measures_opts_t));
+    //  Counters of threads start at separate cache lines
+    if (posix_memalign ((void **) &self->prefilter_stats, 64,
+                        VCACHE_THREADS * sizeof (*self->prefilter_stats)))
+        self->prefilter_stats = NULL;
+    else
+        memset (self->prefilter_stats, 0,
+                VCACHE_THREADS * sizeof (*self->prefilter_stats));
+    assert (self->prefilter_stats);
+    self->local = zmalloc (VCACHE_THREADS * sizeof (void *));
+    self->scratch = zmalloc (VCACHE_THREADS * sizeof (struct _scratch_t));
     // Init configuration
     self->cfg = (config_t *) zmalloc (sizeof (config_t));
     config_init (self->cfg);
@@ -102,7 +353,22 @@ measures_destroy (measures_t **self_p)
         config_destroy(self->cfg);
         printf ("%s cache hitrate: %f\n", self->func->name,
                                           vcache_get_hitrate(self->cache));
+        if (prefilter_count (self, PREFILTER_FULL) > 0)
+            info_msg (1, "%s prefilter: %" PRIu64 " by length, %" PRIu64
+                      " by bag, %" PRIu64 " computed.", self->func->name,
+                      prefilter_count (self, PREFILTER_LENGTH),
+                      prefilter_count (self, PREFILTER_BAG),
+                      prefilter_count (self, PREFILTER_FULL));
+        if (measures_heap (self) > 0)
+            info_msg (1, "%s scratch: %" PRIu64 " heap allocations.",
+                      self->func->name, measures_heap (self));
         vcache_destroy(&self->cache);
+        measures_local_free (self);
+        free (self->local);
+        for (int i = 0; i < VCACHE_THREADS; i++)
+            free (self->scratch[i].buf);
+        free (self->scratch);
+        free (self->prefilter_stats);
         free (self->cfg);
         free (self->opts);
         free (self);
@@ -172,9 +438,33 @@ measures_config (measures_t *self, const char *name)
         self->cache = vcache_new (self->cfg);
 
     //  Configure
+    measures_local_free (self);
     self->idx = measures_match(name);
     self->func = &func[self->idx];
     self->func->measure_config(self);
+
+    //  Bound distances for early termination. Measures building on other
+    //  distances, such as kernels, need exact values.
+    config_lookup_float (self->cfg, "measures.max_distance",
+                         &self->opts->max_dist);
+    if (self->opts->max_dist < 0 || strncmp (self->func->name, "dist_", 5))
+        self->opts->max_dist = INFINITY;
+
+    //  Prefilter cascade for unnormalized edit distances. Its cutoff also
+    //  bounds the full computation.
+    config_lookup_float (self->cfg, "measures.prefilter", &self->prefilter);
+    self->prefilter_cost = prefilter_cost (self);
+    if (self->prefilter < 0 || self->prefilter_cost <= 0 ||
+        self->opts->lnorm != LN_NONE)
+        self->prefilter = INFINITY;
+    else
+        self->opts->max_dist = fmin (self->opts->max_dist, self->prefilter);
+
+    //  Tag persistent values with measure and configuration
+    uint64_t tag = config_fingerprint (self->cfg, "measures");
+    tag ^= hash_str ((char *) self->func->name, strlen (self->func->name));
+    vcache_persist (self->cache, self->cfg, tag);
+
     return self->func->name;
 }
 
@@ -212,7 +502,8 @@ measures_fprint (FILE *f)
 }
 
 /**
- * Compares two strings with the given similarity measure.
+ * Compares two strings with the given similarity measure. Pairs pruned
+ * by the prefilter cascade yield a lower bound beyond its cutoff.
  * @param x first string
  * @param y second second
  * @return similarity/dissimilarity value
@@ -220,12 +511,16 @@ measures_fprint (FILE *f)
 float
 measures_compare (measures_t *self, hstring_t *x, hstring_t *y)
 {
+    float m = 0;
+
+    if (self->prefilter < INFINITY && prefilter_prune (self, x, y, &m))
+        return m;
+
     if (!self->global_cache)
         return self->func->measure_compare (self, x, y);
 
 
     uint64_t xyk = hstring_hash2 (x, y);
-    float m = 0;
 
     if (!vcache_load (self->cache, xyk, &m, ID_COMPARE)) {
         m = self->func->measure_compare(self, x, y);
@@ -288,6 +583,28 @@ measures_config_set_bool (measures_t *self, const char *key, const bool value)
 }
 
 
+//  --------------------------------------------------------------------------
+//  Compares pairs of strings from a thread of the caller
+
+typedef struct {
+    measures_t *measure;
+    hstring_t **strs;
+    float *dists;
+    int n, err;
+} pairs_t;
+
+static void *
+pairs_compare (void *ptr)
+{
+    pairs_t *p = (pairs_t *) ptr;
+    for (int r = 0; r < 3; r++)
+        for (int i = 0; i + 1 < p->n; i++)
+            p->err |= p->measure->func->measure_compare (p->measure,
+                          p->strs[i], p->strs[i + 1]) != p->dists[i];
+    return NULL;
+}
+
+
 //  --------------------------------------------------------------------------
 //  Self test of this class
 
@@ -295,7 +612,156 @@ measures_config_set_bool (measures_t *self, const char *key, const bool value)
 void
 measures_test (bool verbose)
 {
-    printf (" * measures: OK.\n");
+    printf (" * measures:");
+
+    //  @selftest
+    const char *strs[] = {
+        "harry", "hurry", "harry potter", "parry", "yrrah", "sally",
+        "hairy", "", "h", "carrot", "horror", "arrays", NULL
+    };
+    hstring_t *x[16];
+    int i, j, n, err = FALSE;
+
+    //  Prefilter cascade matches the bounded Levenshtein distance
+    measures_t *exact = measures_new ("dist_levenshtein");
+    measures_t *cascade = measures_new ("dist_levenshtein");
+    measures_config_set_float (cascade, "measures.prefilter", 2);
+    assert (cascade->prefilter == 2 && cascade->prefilter_cost == 1);
+    assert ((uintptr_t) cascade->prefilter_stats % 64 == 0);
+
+    for (n = 0; strs[n]; n++) {
+        x[n] = hstring_new (strs[n]);
+        hstring_preproc (x[n], cascade);
+    }
+
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < n; j++) {
+            float d = measures_compare (exact, x[i], x[j]);
+            float f = measures_compare (cascade, x[i], x[j]);
+            err |= d <= 2 ? f != d : f <= 2 || f > d;
+        }
+    }
+
+    //  Every stage is reached by some pairs
+    assert (prefilter_count (cascade, PREFILTER_LENGTH) > 0);
+    assert (prefilter_count (cascade, PREFILTER_BAG) > 0);
+    assert (prefilter_count (cascade, PREFILTER_FULL) > 0);
+    assert (prefilter_count (cascade, PREFILTER_LENGTH) +
+            prefilter_count (cascade, PREFILTER_BAG) +
+            prefilter_count (cascade, PREFILTER_FULL) == n * n);
+
+    //  Normalized distances are not prefiltered
+    measures_config_set_string (cascade, "measures.dist_levenshtein.norm",
+                                "max");
+    assert (cascade->prefilter == INFINITY);
+
+    for (i = 0; i < n; i++)
+        hstring_destroy (&x[i]);
+    measures_destroy (&exact);
+    measures_destroy (&cascade);
+    assert (!err);
+
+    //  Comparisons no larger than a first one do not allocate memory
+    struct {
+        const char *name, *gran;
+        float cost_sub;
+    } scratch[] = {
+        {"dist_levenshtein", "bytes", 1},
+        {"dist_levenshtein", "bytes", 2},
+        {"dist_osa", "bytes", 1},
+        {"dist_damerau", "bytes", 1},
+        {"dist_damerau", "tokens", 1},
+        {"dist_jaro", "bytes", 1},
+        {"kern_subsequence", "tokens", 1},
+        {"dist_compression", "bytes", 1},
+    };
+    int len = 5000;
+    char *a = malloc (len + 1), *b = malloc (len + 1);
+
+    hstring_delim_set (".");
+    for (i = 0; i < len; i++) {
+        a[i] = "abcd."[rand () % 5];
+        b[i] = "abcd."[rand () % 5];
+    }
+
+    for (i = 0; i < sizeof (scratch) / sizeof (scratch[0]); i++) {
+        measures_t *m = measures_new (scratch[i].name);
+        measures_config_set_string (m, "measures.granularity",
+                                    scratch[i].gran);
+        if (scratch[i].cost_sub != 1)
+            measures_config_set_float (m, "measures.dist_levenshtein.cost_sub",
+                                       scratch[i].cost_sub);
+
+        uint64_t heap = 0;
+        for (j = 0; j < 6; j++) {
+            //  Prefixes of the first pair
+            int k = j ? len / 2 + rand () % (len / 2) : len;
+            int l = j ? len / 2 + rand () % (len / 2) : len;
+            char c = a[k], d = b[l];
+            a[k] = b[l] = 0;
+            hstring_t *x = hstring_new (a), *y = hstring_new (b);
+            a[k] = c, b[l] = d;
+
+            hstring_preproc (x, m);
+            hstring_preproc (y, m);
+            m->func->measure_compare (m, x, y);
+            if (j == 0)
+                heap = measures_heap (m);
+            hstring_destroy (&x);
+            hstring_destroy (&y);
+        }
+
+        if (measures_heap (m) != heap) {
+            printf ("Error %s: %" PRIu64 " heap allocations\n",
+                    scratch[i].name, measures_heap (m) - heap);
+            err = TRUE;
+        }
+        measures_destroy (&m);
+    }
+    hstring_delim_reset ();
+    assert (!err);
+
+    //  Threads of the caller get their own scratch memory and state
+    const char *shared[] = { "dist_damerau", "dist_compression", NULL };
+    a[len] = b[len] = 0;
+    for (i = 0; shared[i] && !err; i++) {
+        measures_t *m = measures_new (shared[i]);
+        hstring_t *s[8];
+        float d[8];
+        pairs_t p[4];
+        pthread_t t[4];
+
+        //  The last string is a long prefix for the compression
+        for (j = 0; j < 8; j++) {
+            int k = 200 + j * (i ? 560 : 50);
+            char *src = j % 2 ? a : b, c = src[k];
+            src[k] = 0;
+            s[j] = hstring_new (src + j);
+            src[k] = c;
+            hstring_preproc (s[j], m);
+        }
+        for (j = 0; j + 1 < 8; j++)
+            d[j] = m->func->measure_compare (m, s[j], s[j + 1]);
+
+        for (j = 0; j < 4; j++) {
+            p[j] = (pairs_t) { m, s, d, 8, FALSE };
+            pthread_create (&t[j], NULL, pairs_compare, &p[j]);
+        }
+        for (j = 0; j < 4; j++) {
+            pthread_join (t[j], NULL);
+            err |= p[j].err;
+        }
+
+        for (j = 0; j < 8; j++)
+            hstring_destroy (&s[j]);
+        measures_destroy (&m);
+    }
+    free (a);
+    free (b);
+    assert (!err);
+    //  @end
+
+    printf (" OK\n");
 }
 
 /** @} */
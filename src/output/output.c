@@ -30,6 +30,8 @@
 #include "output_json.h"
 #include "output_matlab.h"
 #include "output_raw.h"
+#include "output_triples.h"
+#include "output_csr.h"
 
 /**
  * Structure for output interface
@@ -37,7 +39,7 @@
 typedef struct
 {
     int (*output_open) (char *);
-    int (*output_write) (hmatrix_t *);
+    long (*output_write) (hmatrix_t *);
     void (*output_close) (void);
 } output_t;
 static output_t func;
@@ -77,6 +79,14 @@ void output_config(const char *format)
         func.output_open = output_raw_open;
         func.output_write = output_raw_write;
         func.output_close = output_raw_close;
+    } else if (!strcasecmp(format, "triples") || !strcasecmp(format, "coo")) {
+        func.output_open = output_triples_open;
+        func.output_write = output_triples_write;
+        func.output_close = output_triples_close;
+    } else if (!strcasecmp(format, "csr")) {
+        func.output_open = output_csr_open;
+        func.output_write = output_csr_write;
+        func.output_close = output_csr_close;
     } else {
         error("Unknown ouptut format '%s', using 'text' instead.", format);
         output_config("text");
@@ -98,7 +108,7 @@ int output_open(char *name)
  * @param m Matrix of similarity values 
  * @return Number of written values
  */
-int output_write(hmatrix_t *m)
+long output_write(hmatrix_t *m)
 {
     return func.output_write(m);
 }
@@ -0,0 +1,161 @@
+/*
+ * Harry - A Tool for Measuring String Similarity
+ * Copyright (C) 2013-2015 Konrad Rieck (konrad@mlsec.org)
+ * --
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.  This program is distributed without any
+ * warranty. See the GNU General Public License for more details. 
+ */
+
+/** 
+ * @addtogroup output
+ * <hr>
+ * <em>csr</em>: The similarity/dissimilarity values are stored in the
+ * compressed sparse row (CSR) format in a text file. The first line holds
+ * the offsets of the rows, the second line the column indices and the
+ * third line the values. Row i of the output corresponds to the i-th row
+ * of the row range. This format is intended for sparse matrices, such as
+ * the strings within a bounded distance. For dense matrices all values
+ * are written.
+ * @{
+ */
+
+#include "config.h"
+#include "common.h"
+#include "util.h"
+#include "output.h"
+#include "harry.h"
+
+
+/* External variables */
+extern config_t cfg;
+
+/* Local variables */
+static void *z = NULL;
+static int zlib = 0;
+static cfg_int precision = 0;
+
+static const char *separator = ",";
+
+#define output_printf(z, ...) (\
+   zlib ? \
+       gzprintf((gzFile) z, __VA_ARGS__) \
+   : \
+       fprintf((FILE *) z, __VA_ARGS__) \
+)
+
+/**
+ * Opens a file for writing a sparse matrix
+ * @param fn File name
+ * @return true if successful, false otherwise
+ */
+int output_csr_open(char *fn)
+{
+    assert(fn);
+
+    config_lookup_string(&cfg, "output.separator", &separator);
+    config_lookup_bool(&cfg, "output.compress", &zlib);
+    config_lookup_int(&cfg, "output.precision", &precision);
+
+    if (zlib)
+        z = gzopen(fn, "w9");
+    else
+        z = fopen(fn, "w");
+
+    if (!z) {
+        error("Could not open output file '%s'.", fn);
+        return FALSE;
+    }
+
+    /* Write harry header */
+    if (zlib)
+        harry_zversion(z, "# ", "Output module for sparse rows (CSR)");
+    else
+        harry_version(z, "# ", "Output module for sparse rows (CSR)");
+
+    return TRUE;
+}
+
+/**
+ * Write one line of the CSR format. Pass 0 writes the row offsets,
+ * pass 1 the column indices and pass 2 the values.
+ * @param m Matrix of similarity values
+ * @param pass Line to write
+ * @param k Pointer to number of cells written
+ * @return true if successful, false otherwise
+ */
+static int output_line(hmatrix_t *m, int pass, long *k)
+{
+    int i, j, n, r = 0;
+    hcell_t *cells;
+
+    *k = 0;
+
+    if (pass == 0)
+        r = output_printf(z, "0");
+
+    for (i = m->row.start; i < m->row.end && r >= 0; i++) {
+        n = hmatrix_get_row(m, i, &cells);
+
+        if (pass == 0) {
+            *k += n >= 0 ? n : RANGE_LENGTH(m->col);
+            r = output_printf(z, "%s%ld", separator, *k);
+            continue;
+        }
+
+        for (j = 0; j < (n >= 0 ? n : RANGE_LENGTH(m->col)) && r >= 0;
+             j++) {
+            int c = n >= 0 ? cells[j].col : m->col.start + j;
+            const char *s = *k > 0 ? separator : "";
+
+            if (pass == 1)
+                r = output_printf(z, "%s%d", s, c);
+            else
+                r = output_printf(z, "%s%g", s, hround(n >= 0 ?
+                                  cells[j].val : hmatrix_get(m, c, i),
+                                  precision));
+            if (r >= 0)
+                (*k)++;
+        }
+    }
+
+    return r >= 0 && output_printf(z, "\n") >= 0;
+}
+
+/**
+ * Write similarity matrix to output. Values are only written in the
+ * last line, such that errors in the first lines report no values.
+ * @param m Matrix of similarity values 
+ * @return Number of written values (negative on error)
+ */
+long output_csr_write(hmatrix_t *m)
+{
+    assert(m);
+    long k = 0;
+
+    for (int pass = 0; pass < 3; pass++) {
+        if (!output_line(m, pass, &k)) {
+            error("Could not write to output file");
+            return pass < 2 ? 0 : -k;
+        }
+    }
+
+    return k;
+}
+
+/**
+ * Closes an open output file.
+ */
+void output_csr_close()
+{
+    if (z) {
+        if (zlib)
+            gzclose(z);
+        else
+            fclose(z);
+    }
+}
+
+/** @} */
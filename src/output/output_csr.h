@@ -0,0 +1,20 @@
+/*
+ * Harry - A Tool for Measuring String Similarity
+ * Copyright (C) 2013-2015 Konrad Rieck (konrad@mlsec.org)
+ * --
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.  This program is distributed without any
+ * warranty. See the GNU General Public License for more details. 
+ */
+
+#ifndef OUTPUT_CSR_H
+#define OUTPUT_CSR_H
+
+/* csr output module */
+int output_csr_open(char *);
+long output_csr_write(hmatrix_t *);
+void output_csr_close(void);
+
+#endif /* OUTPUT_CSR_H */
@@ -78,10 +78,11 @@ int output_json_open(char *fn)
  * @param m Matrix of similarity values 
  * @return Number of written values
  */
-int output_json_write(hmatrix_t *m)
+long output_json_write(hmatrix_t *m)
 {
     assert(m);
-    int i, j, k = 0;
+    int i, j;
+    long k = 0;
 
     if (save_indices) {
         output_printf(z, "  \"col_indices\": [");
@@ -14,7 +14,7 @@
 
 /* json output module */
 int output_json_open(char *);
-int output_json_write(hmatrix_t *);
+long output_json_write(hmatrix_t *);
 void output_json_close(void);
 
 #endif /* OUTPUT_JSON_H */
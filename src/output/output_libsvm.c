@@ -70,10 +70,11 @@ int output_libsvm_open(char *fn)
  * @param m Matrix of similarity values 
  * @return Number of written values
  */
-int output_libsvm_write(hmatrix_t *m)
+long output_libsvm_write(hmatrix_t *m)
 {
     assert(m);
-    int i, j, r, k = 0;
+    int i, j, r;
+    long k = 0;
 
     for (i = m->row.start; i < m->row.end; i++) {
         output_printf(z, "%d 0:%d", (int) m->labels[i], i + 1);
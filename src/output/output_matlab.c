@@ -225,13 +225,20 @@ int output_matlab_open(char *fn)
  * @param m Matrix of similarity values
  * @return Number of written bytes
  */
-static int fwrite_matrix(hmatrix_t *m)
+static long fwrite_matrix(hmatrix_t *m)
 {
-    int r = 0, x, y, i, j;
+    long r = 0;
+    int x, y, i, j;
 
     x = m->col.end - m->col.start;
     y = m->row.end - m->row.start;
 
+    /* Sizes of data elements are limited to 32 bits in version 5 */
+    if ((uint64_t) x * y * sizeof(float) > UINT32_MAX - 256) {
+        error("Matrix too large for Matlab format (v5)");
+        return 0;
+    }
+
     /* Write tag */
     fwrite_uint32(MAT_TYPE_ARRAY, f);
     fwrite_uint32(0, f);
@@ -241,7 +248,7 @@ static int fwrite_matrix(hmatrix_t *m)
     r += fwrite_array_dim(x, y, f);
     r += fwrite_array_name("matrix", f);
     r += fwrite_uint32(MAT_TYPE_SINGLE, f);
-    r += fwrite_uint32(x * y * sizeof(float), f);
+    r += fwrite_uint32((uint64_t) x * y * sizeof(float), f);
 
     /* Write data */
     for (i = m->row.start; i < m->row.end; i++) {
@@ -368,9 +375,9 @@ static int fwrite_sources(range_t ra, char **sources, char *name)
  * @param m Matrix/triangle of similarity values
  * @return Number of written values
  */
-int output_matlab_write(hmatrix_t *m)
+long output_matlab_write(hmatrix_t *m)
 {
-    int r = 0;
+    long r = 0;
 
     /* Write similarity matrix */
     r += fwrite_matrix(m);
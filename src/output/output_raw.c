@@ -61,7 +61,7 @@ int output_raw_open(char *fn)
  * @param m Matrix of similarity values
  * @return Number of written values
  */
-int output_raw_write(hmatrix_t *m)
+long output_raw_write(hmatrix_t *m)
 {
     assert(m);
     uint32_t ret, rows, cols, fsize, i, j;
@@ -14,7 +14,7 @@
 
 /* Raw output module */
 int output_raw_open(char *);
-int output_raw_write(hmatrix_t *);
+long output_raw_write(hmatrix_t *);
 void output_raw_close(void);
 
 #endif /* OUTPUT_RAW_H */
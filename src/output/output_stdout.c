@@ -87,10 +87,11 @@ int output_stdout_open(char *fn)
  * @param m Matrix of similarity values 
  * @return Number of written values
  */
-int output_stdout_write(hmatrix_t *m)
+long output_stdout_write(hmatrix_t *m)
 {
     assert(m);
-    int i, j, r, k = 0;
+    int i, j, r;
+    long k = 0;
 
     if (save_indices) {
         output_printf(z, "#");
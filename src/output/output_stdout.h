@@ -14,7 +14,7 @@
 
 /* stdout output module */
 int output_stdout_open(char *);
-int output_stdout_write(hmatrix_t *);
+long output_stdout_write(hmatrix_t *);
 void output_stdout_close(void);
 
 #endif /* OUTPUT_STDOUT_H */
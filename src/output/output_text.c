@@ -84,10 +84,11 @@ int output_text_open(char *fn)
  * @param m Matrix of similarity values 
  * @return Number of written values
  */
-int output_text_write(hmatrix_t *m)
+long output_text_write(hmatrix_t *m)
 {
     assert(m);
-    int i, j, r, k = 0;
+    int i, j, r;
+    long k = 0;
 
     if (save_indices) {
         output_printf(z, "#");
@@ -0,0 +1,143 @@
+/*
+ * Harry - A Tool for Measuring String Similarity
+ * Copyright (C) 2013-2015 Konrad Rieck (konrad@mlsec.org)
+ * --
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.  This program is distributed without any
+ * warranty. See the GNU General Public License for more details. 
+ */
+
+/** 
+ * @addtogroup output
+ * <hr>
+ * <em>triples</em>: The similarity/dissimilarity values are stored as
+ * triples (row, col, value) in a text file, one triple per line. This
+ * coordinate (COO) format is intended for sparse matrices, such as the
+ * k nearest strings of each row. For sparse rows the triples are sorted
+ * from most to least similar. For dense matrices all values are written.
+ * @{
+ */
+
+#include "config.h"
+#include "common.h"
+#include "util.h"
+#include "output.h"
+#include "harry.h"
+
+
+/* External variables */
+extern config_t cfg;
+
+/* Local variables */
+static void *z = NULL;
+static int zlib = 0;
+static cfg_int precision = 0;
+
+static const char *separator = ",";
+
+#define output_printf(z, ...) (\
+   zlib ? \
+       gzprintf((gzFile) z, __VA_ARGS__) \
+   : \
+       fprintf((FILE *) z, __VA_ARGS__) \
+)
+
+/**
+ * Opens a file for writing triples
+ * @param fn File name
+ * @return true if successful, false otherwise
+ */
+int output_triples_open(char *fn)
+{
+    assert(fn);
+
+    config_lookup_string(&cfg, "output.separator", &separator);
+    config_lookup_bool(&cfg, "output.compress", &zlib);
+    config_lookup_int(&cfg, "output.precision", &precision);
+
+    if (zlib)
+        z = gzopen(fn, "w9");
+    else
+        z = fopen(fn, "w");
+
+    if (!z) {
+        error("Could not open output file '%s'.", fn);
+        return FALSE;
+    }
+
+    /* Write harry header */
+    if (zlib)
+        harry_zversion(z, "# ", "Output module for triples (COO)");
+    else
+        harry_version(z, "# ", "Output module for triples (COO)");
+
+    return TRUE;
+}
+
+/**
+ * Write a triple to the output
+ * @param r Row index
+ * @param c Column index
+ * @param f Value
+ * @return true if successful, false otherwise
+ */
+static int output_triple(int r, int c, float f)
+{
+    float val = hround(f, precision);
+    return output_printf(z, "%d%s%d%s%g\n", r, separator, c, separator,
+                         val) >= 0;
+}
+
+/**
+ * Write similarity matrix to output
+ * @param m Matrix of similarity values 
+ * @return Number of written values
+ */
+long output_triples_write(hmatrix_t *m)
+{
+    assert(m);
+    int i, j, n;
+    long k = 0;
+    hcell_t *cells;
+
+    for (i = m->row.start; i < m->row.end; i++) {
+        n = hmatrix_get_row(m, i, &cells);
+
+        /* Sparse row */
+        for (j = 0; j < n; j++, k++) {
+            if (!output_triple(i, cells[j].col, cells[j].val)) {
+                error("Could not write to output file");
+                return -k;
+            }
+        }
+        if (n >= 0)
+            continue;
+
+        /* Dense row */
+        for (j = m->col.start; j < m->col.end; j++, k++) {
+            if (!output_triple(i, j, hmatrix_get(m, j, i))) {
+                error("Could not write to output file");
+                return -k;
+            }
+        }
+    }
+
+    return k;
+}
+
+/**
+ * Closes an open output file.
+ */
+void output_triples_close()
+{
+    if (z) {
+        if (zlib)
+            gzclose(z);
+        else
+            fclose(z);
+    }
+}
+
+/** @} */
@@ -24,14 +24,6 @@
  * @{
  */
 
-typedef struct
-{
-    sym_t sym;          /**< Symbol or character */
-    float cnt;          /**< Count of symbol */
-    UT_hash_handle hh;  /**< uthash handle */
-} bag_t;
-
-
 void sim_coefficient_config(measures_t *self)
 {
     assert (self);
@@ -49,51 +41,14 @@ void sim_coefficient_config(measures_t *self)
         warning("Unknown matching '%s'. Using 'cnt' instead.", str);
         opts->binary = FALSE;
     }
-}
-
-
-/**
- * Computes a histogram of symbols or characters
- * @param x string
- * @return histogram
- */
-static bag_t *bag_create(hstring_t *x)
-{
-    bag_t *xh = NULL, *bag = NULL;
-
-    for (int i = 0; i < x->len; i++) {
-        sym_t s = hstring_get(x, i);
-        HASH_FIND(hh, xh, &s, sizeof(sym_t), bag);
 
-        if (!bag) {
-            bag = (bag_t *) zmalloc(sizeof(bag_t));
-            bag->sym = s;
-            bag->cnt = 0;
-            HASH_ADD(hh, xh, sym, sizeof(sym_t), bag);
-        }
-
-        bag->cnt++;
-    }
-
-    return xh;
+    /* Approximation by sketches */
+    config_lookup_int (self->cfg, "measures.sim_coefficient.sketch", &opts->sketch);
 }
 
-/**
- * Free the memory of histogram
- * @param xh Histogram
- */
-static void bag_destroy(bag_t * xh)
-{
-    /* Clear hash table */
-    while (xh) {
-        bag_t *bag = xh;
-        HASH_DEL(xh, bag);
-        free(bag);
-    }
-}
 
 /**
- * Computes the matches and mismatches
+ * Computes the matches and mismatches from the histograms of the strings
  * @param x first string
  * @param y second string
  * @return matches
@@ -101,49 +56,22 @@ static void bag_destroy(bag_t * xh)
 static match_t match(measures_t *self, hstring_t *x, hstring_t *y)
 {
     measures_opts_t *opts = self->opts;
-    bag_t *xh, *yh, *xb, *yb;
+    overlap_t o = opts->sketch > 0 ? hist_estimate(self, x, y) :
+                  hist_overlap(self, x, y);
     match_t m;
-    int missing;
-
-    m.a = 0;
-    m.b = 0;
-    m.c = 0;
-
-    xh = bag_create(x);
-    yh = bag_create(y);
 
     if (!opts->binary) {
         /* Count matching */
-        missing = y->len;
-        for (xb = xh; xb != NULL; xb = (bag_t *) xb->hh.next) {
-            HASH_FIND(hh, yh, &(xb->sym), sizeof(sym_t), yb);
-            if (!yb) {
-                m.b += xb->cnt;
-            } else {
-                m.a += fmin(xb->cnt, yb->cnt);
-                missing -= fmin(xb->cnt, yb->cnt);
-                if (yb->cnt < xb->cnt)
-                    m.b += xb->cnt - yb->cnt;
-            }
-        }
-        m.c += missing;
+        m.a = o.inter;
+        m.b = x->len - o.inter;
+        m.c = y->len - o.inter;
     } else {
         /* Binary matching */
-        missing = HASH_COUNT(yh);
-        for (xb = xh; xb != NULL; xb = (bag_t *) xb->hh.next) {
-            HASH_FIND(hh, yh, &(xb->sym), sizeof(sym_t), yb);
-            if (!yb) {
-                m.b += 1;
-            } else {
-                m.a += 1;
-                missing -= 1;
-            }
-        }
-        m.c += missing;
+        m.a = o.shared;
+        m.b = o.nx - o.shared;
+        m.c = o.ny - o.shared;
     }
 
-    bag_destroy(xh);
-    bag_destroy(yh);
     return m;
 }
 
@@ -350,6 +278,62 @@ sim_coefficient_test (bool verbose)
         hstring_destroy (&y);
     }
     measures_destroy (&dice);
+
+    //  Sketches estimate the coefficients of random token sets
+    const char *matching[] = {"bin", "cnt"};
+    char a[4001], b[4001];
+    int j, n;
+
+    jaccard = measures_new ("sim_jaccard");
+    measures_t *approx = measures_new ("sim_jaccard");
+    measures_config_set_string (jaccard, "measures.token_delim", ".");
+    measures_config_set_string (approx, "measures.token_delim", ".");
+    measures_config_set_string (jaccard, "measures.granularity", "tokens");
+    measures_config_set_string (approx, "measures.granularity", "tokens");
+    measures_config_set_int (approx, "measures.sim_coefficient.sketch", 512);
+
+    for (i = 0; i < 40; i++) {
+        measures_config_set_string (jaccard, "measures.sim_coefficient.matching",
+                                    matching[i % 2]);
+        measures_config_set_string (approx, "measures.sim_coefficient.matching",
+                                    matching[i % 2]);
+
+        //  Tokens of y are changed with varying probability
+        n = 1000 + rand () % 3000;
+        for (j = 0; j < n; j++) {
+            a[j] = b[j] = j % 4 == 3 ? '.' : 'a' + rand () % 16;
+            if (b[j] != '.' && rand () % 40 < i)
+                b[j] = 'A' + rand () % 16;
+        }
+        a[n] = b[n] = 0;
+
+        x = hstring_new (a);
+        y = hstring_new (b);
+        hstring_preproc (x, approx);
+        hstring_preproc (y, approx);
+        assert (x->sketch && y->sketch);
+
+        float d = measures_compare (jaccard, x, y);
+        float e = measures_compare (approx, x, y);
+        if (fabs (d - e) > 0.1) {
+            printf ("Error %f != %f (%s)\n", e, d, matching[i % 2]);
+            err = TRUE;
+        }
+
+        //  Identical sketches are exact
+        if (measures_compare (approx, x, x) != 1) {
+            printf ("Error %f != 1\n", measures_compare (approx, x, x));
+            err = TRUE;
+        }
+
+        hstring_destroy (&x);
+        hstring_destroy (&y);
+    }
+
+    measures_destroy (&jaccard);
+    measures_destroy (&approx);
+    hstring_delim_reset ();
+    assert (!err);
     //  @end
 
     printf(" OK\n");
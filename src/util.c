@@ -172,7 +172,7 @@ void prog_bar(vcache_t *cache, long a, long b, long c)
 #ifdef HAVE_OPENMP
     fprintf(stderr, "\r[%.2d][%s %3.0f%% %s %.2dm %.2ds][%3.0f%% %5.1fMb]",
             omp_get_num_threads(), pb_string, perc * 100, descr,
-            mins, secs, vcache_get_hitrate(), vcache_get_used());
+            mins, secs, vcache_get_hitrate(cache), vcache_get_used(cache));
 #else
     fprintf(stderr, "\r[%s %3.0f%% %s %.2dm %.2ds][%3.0f%% %5.1fMb]",
             pb_string, perc * 100, descr, mins, secs,
@@ -381,8 +381,8 @@ void log_print(vcache_t *cache, long a, long b, long c)
 #ifdef HAVE_OPENMP
     fprintf(stderr, "[%s] state: %.0f%%, threads: %d, vcache: %.0f%%/%.0f%%, "
             "eta: %dh%.2dm%.2ds\n", buf,
-            perc * 100, omp_get_num_threads(), vcache_get_used() * 100,
-            vcache_get_hitrate() * 100, hours, mins, secs);
+            perc * 100, omp_get_num_threads(), vcache_get_used(cache) * 100,
+            vcache_get_hitrate(cache) * 100, hours, mins, secs);
 #else
     fprintf(stderr, "[%s] state: %.0f%%, vcache: %.0f%%/%.0f%%, "
             "eta: %dh%.2dm%.2ds\n", buf,
@@ -406,6 +406,26 @@ float hround(float f, int p)
     return round(f * pow(10, p)) / pow(10, p);
 }
 
+/**
+ * Determines the widest vector instructions supported by the CPU. The
+ * check is cheap and can be called for every comparison.
+ * @return level of vector instructions (SIMD_NONE, ...)
+ */
+int simd_level()
+{
+#if SIMD_X86
+    if (__builtin_cpu_supports("avx2"))
+        return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+        return SIMD_SSE42;
+    return SIMD_NONE;
+#elif SIMD_ARM
+    return SIMD_NEON;
+#else
+    return SIMD_NONE;
+#endif
+}
+
 
 //  --------------------------------------------------------------------------
 //  Self test of this class
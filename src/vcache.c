@@ -10,6 +10,14 @@
  */
 
 #include "harry_classes.h"
+#include <sys/file.h>
+#include <sys/mman.h>
+
+/* Statistics of a thread per task ID (padded to cache lines) */
+typedef struct {
+    uint64_t hits[ID_MAX];
+    uint64_t misses[ID_MAX];
+} __attribute__ ((aligned (64))) stats_t;
 
 struct _vcache_t {
     /* Cache structure */
@@ -17,21 +25,294 @@ struct _vcache_t {
     long space;
     long size;
 
-    /* Cache statistics */
-    double hits;
-    double misses;
+    /* Sets of entries */
+    long sets;
+    int ways;
+    uint8_t *hands;
+
+    /* Cache statistics per thread */
+    stats_t *stats;
+
+    /* Persistent cache file */
+    char *path;
+    fheader_t *header;
+    fentry_t *file;
+    size_t flen;
+    long fsets;
+    int fways;
+    int readonly;
+    uint64_t tag;
+};
 
-    /* Read-write cache for lock */
-    rwlock_t rwlock;
+/* Names of task IDs */
+static const char *id_names[ID_MAX] = {
+    "", "compare", "dist_compress", "norm", "kern_distance", "dist_kernel"
 };
 
 /**
  * @defgroup vcache Value cache
- * Cache for similarity values based on uthash.
+ * Lock-free cache for similarity values. The cache is organized in sets
+ * of 1, 2, 4 or 8 entries (ways) and evicts entries of a set using the
+ * CLOCK policy. Entries are protected by a sequence counter (seqlock),
+ * such that readers never block and writers skip entries that are updated
+ * concurrently. Statistics are collected per thread and task ID and
+ * aggregated on demand.
+ *
+ * Optionally, values are additionally kept in a memory-mapped file that
+ * persists across runs. Keys in the file are mixed with a tag derived
+ * from the measure and its configuration, such that values of different
+ * measures can share one file. The file can be opened read-only and
+ * shared between concurrent processes.
  * @author Konrad Rieck (konrad@mlsec.org)
  * @{
  */
 
+//  --------------------------------------------------------------------------
+//  Numbers the calling thread for its per-thread slots. Numbers are kept
+//  in thread-local storage, such that threads of OpenMP and threads of the
+//  caller never share a slot, and are reused once a thread exits. Returns
+//  -1 if all numbers are taken.
+
+static pthread_key_t thread_key;
+static pthread_once_t thread_once = PTHREAD_ONCE_INIT;
+static uint64_t thread_used[VCACHE_THREADS / 64];
+
+static void
+thread_exit (void *ptr)
+{
+    int i = (int) (intptr_t) ptr - 1;
+    __atomic_fetch_and (&thread_used[i / 64], ~(1ULL << (i % 64)),
+                        __ATOMIC_RELEASE);
+}
+
+static void
+thread_init (void)
+{
+    pthread_key_create (&thread_key, thread_exit);
+}
+
+int
+vcache_thread_slot (void)
+{
+    pthread_once (&thread_once, thread_init);
+    intptr_t id = (intptr_t) pthread_getspecific (thread_key);
+    if (id)
+        return (int) id - 1;
+
+    for (int i = 0; i < VCACHE_THREADS / 64; i++) {
+        uint64_t w = __atomic_load_n (&thread_used[i], __ATOMIC_RELAXED);
+        while (~w) {
+            int b = __builtin_ctzll (~w);
+            if (__atomic_compare_exchange_n (&thread_used[i], &w,
+                                             w | (1ULL << b), 0,
+                                             __ATOMIC_ACQUIRE,
+                                             __ATOMIC_RELAXED)) {
+                id = i * 64 + b + 1;
+                pthread_setspecific (thread_key, (void *) id);
+                return (int) id - 1;
+            }
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * Returns the statistics of the calling thread. Threads beyond the
+ * number of slots share the statistics of the first slot.
+ * @param self Cache object
+ * @return statistics
+ */
+static stats_t *
+thread_stats (vcache_t *self)
+{
+    return &self->stats[MAX (vcache_thread_slot (), 0)];
+}
+
+
+//  --------------------------------------------------------------------------
+//  Close persistent cache file
+
+static void
+file_close (vcache_t *self)
+{
+    if (self->header)
+        munmap (self->header, self->flen);
+    free (self->path);
+    self->path = NULL;
+    self->header = NULL;
+    self->file = NULL;
+    self->flen = 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Open persistent cache file. A new file is created with the given size
+//  in megabytes if the file does not exist or is empty. Returns false if
+//  the file cannot be opened or is not a valid cache file.
+
+static int
+file_open (vcache_t *self, const char *path, long size, int readonly)
+{
+    fheader_t header;
+    struct stat st;
+    size_t len;
+    void *map;
+
+    int fd = open (path, readonly ? O_RDONLY : O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        error ("Could not open cache file '%s'", path);
+        return FALSE;
+    }
+
+    //  Serialize creation of the file between processes
+    flock (fd, readonly ? LOCK_SH : LOCK_EX);
+    if (fstat (fd, &st) < 0)
+        goto err;
+
+    if (st.st_size == 0 && !readonly) {
+        memset (&header, 0, sizeof (fheader_t));
+        memcpy (header.magic, VCACHE_MAGIC, sizeof (header.magic));
+        header.ways = self->ways;
+        header.sets = MAX (1, (size * 1024 * 1024) / sizeof (fentry_t)
+                                / self->ways);
+        len = sizeof (fheader_t) + header.sets * header.ways * sizeof (fentry_t);
+        if (ftruncate (fd, len) < 0 ||
+            pwrite (fd, &header, sizeof (fheader_t), 0) != sizeof (fheader_t))
+            goto err;
+    } else {
+        if (pread (fd, &header, sizeof (fheader_t), 0) != sizeof (fheader_t))
+            goto err;
+        len = sizeof (fheader_t) + header.sets * header.ways * sizeof (fentry_t);
+        if (memcmp (header.magic, VCACHE_MAGIC, sizeof (header.magic)) ||
+            header.ways < 1 || header.ways > VCACHE_WAYS ||
+            (header.ways & (header.ways - 1)) || header.sets < 1 ||
+            (size_t) st.st_size != len)
+            goto err;
+    }
+
+    map = mmap (NULL, len, readonly ? PROT_READ : PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+        goto err;
+
+    flock (fd, LOCK_UN);
+    close (fd);
+
+    self->path = strdup (path);
+    self->header = (fheader_t *) map;
+    self->file = (fentry_t *) (self->header + 1);
+    self->flen = len;
+    self->fsets = header.sets;
+    self->fways = header.ways;
+    self->readonly = readonly;
+
+    info_msg (1, "Mapping cache file '%s' (%lu entries, %d-way%s)", path,
+              self->fsets * self->fways, self->fways,
+              readonly ? ", read-only" : "");
+    return TRUE;
+
+err:
+    error ("Invalid or inaccessible cache file '%s'", path);
+    flock (fd, LOCK_UN);
+    close (fd);
+    return FALSE;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Computes the key of a value in the persistent cache from the key, the
+//  task ID and the tag of the cache
+
+static uint64_t
+fmix (uint64_t k)
+{
+    //  Finalizer of MurmurHash3
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+static uint64_t
+file_key (vcache_t *self, uint64_t key, int id)
+{
+    uint64_t k = fmix (fmix (key ^ self->tag) ^ id);
+    return k ? k : 1;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Load a value from the persistent cache
+
+static int
+file_load (vcache_t *self, uint64_t key, float *value, int id)
+{
+    if (!self->file || !self->tag)
+        return FALSE;
+
+    uint64_t k = file_key (self, key, id);
+    fentry_t *ways = self->file + (k % self->fsets) * self->fways;
+    uint32_t seq1, seq2;
+    uint64_t fk;
+    float v;
+    int w;
+
+    for (w = 0; w < self->fways; w++) {
+        seq1 = __atomic_load_n (&ways[w].seq, __ATOMIC_ACQUIRE);
+        fk = __atomic_load_n (&ways[w].key, __ATOMIC_RELAXED);
+        __atomic_load (&ways[w].val, &v, __ATOMIC_RELAXED);
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        seq2 = __atomic_load_n (&ways[w].seq, __ATOMIC_RELAXED);
+
+        if (!(seq1 & 1) && seq1 == seq2 && fk == k) {
+            *value = v;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Store a value in the persistent cache. An empty or matching entry of the
+//  set is used if available, otherwise an entry selected by the key is
+//  replaced. Entries written concurrently by other threads or processes are
+//  skipped.
+
+static void
+file_store (vcache_t *self, uint64_t key, float value, int id)
+{
+    if (!self->file || !self->tag || self->readonly)
+        return;
+
+    uint64_t k = file_key (self, key, id), fk;
+    fentry_t *ways = self->file + (k % self->fsets) * self->fways;
+    fentry_t *e = &ways[(k >> 32) & (self->fways - 1)];
+    uint32_t seq;
+    int w;
+
+    for (w = 0; w < self->fways; w++) {
+        fk = __atomic_load_n (&ways[w].key, __ATOMIC_RELAXED);
+        if (fk == k || fk == 0) {
+            e = &ways[w];
+            break;
+        }
+    }
+
+    seq = __atomic_load_n (&e->seq, __ATOMIC_RELAXED);
+    if ((seq & 1) || !__atomic_compare_exchange_n (&e->seq, &seq, seq + 1,
+            FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    __atomic_store_n (&e->key, k, __ATOMIC_RELAXED);
+    __atomic_store (&e->val, &value, __ATOMIC_RELAXED);
+    __atomic_store_n (&e->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
 
 //  --------------------------------------------------------------------------
 //  Create new cache object
@@ -42,23 +323,33 @@ vcache_new (config_t *cfg)
     assert (cfg);
     vcache_t *self = (vcache_t *) zmalloc (sizeof (vcache_t));
 
-    //  Lookup cache size
-    cfg_int csize;
+    //  Lookup cache size and associativity
+    cfg_int csize, ways;
     config_lookup_int (cfg, "measures.cache_size", &csize);
+    config_lookup_int (cfg, "measures.cache_ways", &ways);
+    if (ways < 1 || ways > VCACHE_WAYS || (ways & (ways - 1))) {
+        warning ("Invalid number of cache ways (%d). Using 4.", ways);
+        ways = 4;
+    }
 
     //  Initialize cache stats
-    self->space = floor ((csize * 1024 * 1024) / sizeof (entry_t));
+    self->ways = ways;
+    self->sets = MAX (1, floor ((csize * 1024 * 1024) / sizeof (entry_t)) / ways);
+    self->space = self->sets * ways;
     self->size = 0;
-    self->misses = 0;
-    self->hits = 0;
 
-    info_msg (1, "Initializing cache with %dMb (%d entries)", csize, self->space);
+    info_msg (1, "Initializing cache with %dMb (%ld entries, %d-way)", csize,
+              self->space, ways);
 
     self->cache = (entry_t *) zmalloc (self->space * sizeof (entry_t));
-    assert (self->cache);
-
-    //  Initialize lock
-    rwlock_init (&self->rwlock);
+    self->hands = (uint8_t *) zmalloc (self->sets * sizeof (uint8_t));
+    //  Statistics start at a cache line, such that threads never share one
+    if (posix_memalign ((void **) &self->stats, 64,
+                        VCACHE_THREADS * sizeof (stats_t)))
+        self->stats = NULL;
+    else
+        memset (self->stats, 0, VCACHE_THREADS * sizeof (stats_t));
+    assert (self->cache && self->hands && self->stats);
 
     return self;
 }
@@ -75,11 +366,13 @@ vcache_destroy (vcache_t **self_p)
     if (*self_p) {
         vcache_t *self = *self_p;
 
-        //  Destroy lock
-        rwlock_destroy(&self->rwlock);
+        //  Unmap persistent cache
+        file_close (self);
 
-        //  Clear hash table
+        //  Clear hash table and statistics
         free (self->cache);
+        free (self->hands);
+        free (self->stats);
 
         //  Free self
         free(self);
@@ -87,7 +380,8 @@ vcache_destroy (vcache_t **self_p)
 }
 
 //  --------------------------------------------------------------------------
-//  Invalidate cache without freeing the memory
+//  Invalidate cache without freeing the memory. Values in the persistent
+//  cache are kept, as they are distinguished by their tag.
 
 void
 vcache_invalidate (vcache_t *self)
@@ -96,41 +390,152 @@ vcache_invalidate (vcache_t *self)
     int index;
     for (index = 0; index < self->space; index++)
         self->cache[index].key = 0;
+    self->size = 0;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Attach the persistent cache file given in the configuration and set the
+//  tag of stored values. The tag should identify the measure and its
+//  configuration. The file is reopened only if its path or mode changed.
+//  The size applies to newly created files only, so a changed size of an
+//  attached file is ignored.
+//  @param cfg Configuration
+//  @param tag Tag of values (e.g. fingerprint of configuration)
+
+void
+vcache_persist (vcache_t *self, config_t *cfg, uint64_t tag)
+{
+    assert (self && cfg);
+    const char *path;
+    cfg_int size;
+    int readonly;
+
+    config_lookup_string (cfg, "measures.cache_file", &path);
+    config_lookup_int (cfg, "measures.cache_file_size", &size);
+    config_lookup_bool (cfg, "measures.cache_readonly", &readonly);
+
+    self->tag = tag;
+    if (self->path && !strcmp (self->path, path) &&
+        self->readonly == readonly)
+        return;
+
+    file_close (self);
+    if (strlen (path) > 0)
+        file_open (self, path, size, readonly);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Read an entry consistently. Returns false if the entry is written
+//  concurrently.
+
+static int
+entry_read (entry_t *e, uint64_t *key, int *id, float *val)
+{
+    uint32_t seq1, seq2;
+
+    seq1 = __atomic_load_n (&e->seq, __ATOMIC_ACQUIRE);
+    *key = __atomic_load_n (&e->key, __ATOMIC_RELAXED);
+    *id = __atomic_load_n (&e->id, __ATOMIC_RELAXED);
+    __atomic_load (&e->val, val, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    seq2 = __atomic_load_n (&e->seq, __ATOMIC_RELAXED);
+
+    return !(seq1 & 1) && seq1 == seq2;
 }
 
 
 //  --------------------------------------------------------------------------
-//  Store a similarity value. The value is associated with 64 bit key that
+//  Write an entry. Returns false if the entry is written concurrently.
+
+static int
+entry_write (vcache_t *self, entry_t *e, uint64_t key, int id, float val)
+{
+    uint32_t seq = __atomic_load_n (&e->seq, __ATOMIC_RELAXED);
+
+    //  Acquire entry by making the sequence odd
+    if ((seq & 1) || !__atomic_compare_exchange_n (&e->seq, &seq, seq + 1,
+            FALSE, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return FALSE;
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+
+    if (__atomic_load_n (&e->key, __ATOMIC_RELAXED) == 0)
+        __atomic_fetch_add (&self->size, 1, __ATOMIC_RELAXED);
+
+    __atomic_store_n (&e->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n (&e->id, id, __ATOMIC_RELAXED);
+    __atomic_store (&e->val, &val, __ATOMIC_RELAXED);
+    __atomic_store_n (&e->ref, 0, __ATOMIC_RELAXED);
+
+    //  Release entry
+    __atomic_store_n (&e->seq, seq + 2, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+
+//  --------------------------------------------------------------------------
+//  Store a similarity value in memory. The value is associated with 64 bit key that
 //  can be computed from a string, a sequence of symbols or even a pair
-//  of strings. Collisions may occur, but are not likely.
+//  of strings. Collisions may occur, but are not likely. If the set is
+//  full, an entry is evicted using the CLOCK policy. If the entry is
+//  currently written by another thread, the value is not stored.
 //  @param key Key for similarity value
 //  @param value Value to store
 //  @param id ID of task
 //  @return true on success, false otherwise
 
-int
-vcache_store (vcache_t *self, uint64_t key, float value, int id)
+static int
+mem_store (vcache_t *self, uint64_t key, float value, int id)
 {
-    int idx;
+    long set = (key ^ id) % self->sets;
+    entry_t *ways = self->cache + set * self->ways, *e = ways;
+    uint64_t k;
+    float v;
+    int i, w, h;
+
+    //  Update existing or fill empty entry
+    for (w = 0; w < self->ways; w++) {
+        if (!entry_read (&ways[w], &k, &i, &v))
+            continue;
+        if ((k == key && i == id) || k == 0)
+            return entry_write (self, &ways[w], key, id, value);
+    }
 
-    idx = (key ^ id) % self->space;
+    //  Advance clock hand to an entry not referenced recently
+    h = __atomic_load_n (&self->hands[set], __ATOMIC_RELAXED);
+    for (w = 0; w < 2 * self->ways; w++) {
+        e = &ways[h];
+        h = (h + 1) & (self->ways - 1);
+        if (!__atomic_load_n (&e->ref, __ATOMIC_RELAXED))
+            break;
+        __atomic_store_n (&e->ref, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n (&self->hands[set], h, __ATOMIC_RELAXED);
 
-    rwlock_set_wlock(&self->rwlock);
+    return entry_write (self, e, key, id, value);
+}
 
-    if (self->cache[idx].key == 0)
-        self->size++;
 
-    self->cache[idx].key = key;
-    self->cache[idx].val = value;
-    self->cache[idx].id = id;
-    rwlock_unset_wlock(&self->rwlock);
+//  --------------------------------------------------------------------------
+//  Store a similarity value in memory and in the persistent cache.
+//  @param key Key for similarity value
+//  @param value Value to store
+//  @param id ID of task
+//  @return true on success, false otherwise
 
-    return TRUE;
+int
+vcache_store (vcache_t *self, uint64_t key, float value, int id)
+{
+    file_store (self, key, value, id);
+    return mem_store (self, key, value, id);
 }
 
 
 //  --------------------------------------------------------------------------
-//  Load a similarity value. The value is associated with 64 bit key.
+//  Load a similarity value. The value is associated with 64 bit key. An
+//  entry that is written concurrently is treated as a miss. Values missing
+//  in memory are looked up in the persistent cache.
 //  @param key Key for similarity value
 //  @param value Pointer to space for value
 //  @param id ID of task
@@ -138,21 +543,35 @@ vcache_store (vcache_t *self, uint64_t key, float value, int id)
 
 int vcache_load(vcache_t *self, uint64_t key, float *value, int id)
 {
-    int ret, idx;
+    long set = (key ^ id) % self->sets;
+    entry_t *ways = self->cache + set * self->ways;
+    stats_t *stats = thread_stats (self);
+    uint64_t k;
+    float v;
+    int i, w;
+
+    for (w = 0; w < self->ways; w++) {
+        if (!entry_read (&ways[w], &k, &i, &v) || k != key || i != id)
+            continue;
+
+        //  Mark entry as referenced
+        if (!__atomic_load_n (&ways[w].ref, __ATOMIC_RELAXED))
+            __atomic_store_n (&ways[w].ref, 1, __ATOMIC_RELAXED);
+
+        *value = v;
+        __atomic_fetch_add (&stats->hits[id % ID_MAX], 1, __ATOMIC_RELAXED);
+        return TRUE;
+    }
 
-    idx = (key ^ id) % self->space;
-    rwlock_set_rlock(&self->rwlock);
-    if (self->cache[idx].key == key && self->cache[idx].id == id) {
-        *value = self->cache[idx].val;
-        ret = TRUE;
-        self->hits++;
-    } else {
-        ret = FALSE;
-        self->misses++;
+    if (file_load (self, key, &v, id)) {
+        mem_store (self, key, v, id);
+        *value = v;
+        __atomic_fetch_add (&stats->hits[id % ID_MAX], 1, __ATOMIC_RELAXED);
+        return TRUE;
     }
 
-    rwlock_unset_rlock(&self->rwlock);
-    return ret;
+    __atomic_fetch_add (&stats->misses[id % ID_MAX], 1, __ATOMIC_RELAXED);
+    return FALSE;
 }
 
 
@@ -163,10 +582,23 @@ void vcache_info(vcache_t *self)
 {
     float used = (self->size * sizeof(entry_t)) / (1024.0 * 1024.0);
     float free = (self->space * sizeof(entry_t)) / (1024.0 * 1024.0);
+    int id;
 
     info_msg(1,
-             "Cache stats: %.1fMb used by %d entries, hits %3.0f%%, %.1fMb free.",
-             used, self->size, 100 * self->hits / (self->hits + self->misses), free);
+             "Cache stats: %.1fMb used by %ld entries, hits %3.0f%%, %.1fMb free.",
+             used, self->size, vcache_get_hitrate(self), free);
+
+    if (self->file)
+        info_msg(1, "Cache file: '%s' with %.1fMb%s", self->path,
+                 self->flen / (1024.0 * 1024.0),
+                 self->readonly ? " (read-only)" : "");
+
+    for (id = 1; id < ID_MAX; id++) {
+        if (!id_names[id])
+            continue;
+        info_msg(1, "  %-16s hits %3.0f%%", id_names[id],
+                 vcache_get_hitrate_id(self, id));
+    }
 }
 
 
@@ -186,8 +618,32 @@ float vcache_get_used(vcache_t *self)
 
 float vcache_get_hitrate(vcache_t *self)
 {
-    const double total = (self->hits + self->misses);
-    return (total <= 0 ? 0 : 100 * self->hits / (self->hits + self->misses));
+    return vcache_get_hitrate_id(self, 0);
+}
+
+
+//  --------------------------------------------------------------------------
+//  Get hit rate of a task
+//  @param id ID of task (0 for all tasks)
+//  @return hit rate
+
+float vcache_get_hitrate_id(vcache_t *self, int id)
+{
+    double hits = 0, total = 0;
+    int i, j;
+
+    //  Aggregate statistics of threads
+    for (i = 0; i < VCACHE_THREADS; i++) {
+        for (j = 0; j < ID_MAX; j++) {
+            if (id && j != id % ID_MAX)
+                continue;
+            hits += __atomic_load_n (&self->stats[i].hits[j], __ATOMIC_RELAXED);
+            total += __atomic_load_n (&self->stats[i].misses[j], __ATOMIC_RELAXED);
+        }
+    }
+    total += hits;
+
+    return (total <= 0 ? 0 : 100 * hits / total);
 }
 
 
@@ -205,6 +661,9 @@ vcache_test (bool verbose)
     config_check (cfg);
     vcache_t *cache = vcache_new (cfg);
 
+    //  Statistics of threads occupy separate cache lines
+    assert ((uintptr_t) cache->stats % 64 == 0 && sizeof (stats_t) % 64 == 0);
+
     hstring_t *h1 = hstring_new("Test1");
     hstring_t *h2 = hstring_new("Test2");
     uint64_t h1h2_hash = hstring_hash2 (h1, h2);
@@ -215,12 +674,80 @@ vcache_test (bool verbose)
     vcache_store (cache, h1h2_hash, m, ID_COMPARE);
     assert (vcache_load (cache, h1h2_hash, &m, ID_COMPARE));
 
+    //  Concurrent stores and loads never return foreign values
+    int i, err = 0;
+#ifdef HAVE_OPENMP
+#pragma omp parallel for reduction(+:err)
+#endif
+    for (i = 0; i < 200000; i++) {
+        uint64_t key = (i % 5000 + 1) * 0x9e3779b97f4a7c15ULL;
+        float v = i % 5000;
+        vcache_store (cache, key, v, ID_NORM);
+        if (vcache_load (cache, key, &v, ID_NORM) && v != i % 5000)
+            err++;
+    }
+    assert (err == 0);
+    assert (vcache_get_hitrate (cache) > 0);
+    assert (vcache_get_hitrate_id (cache, ID_NORM) > 0);
+
+    //  Referenced entries survive eviction within a set
+    uint64_t hot = (5 + cache->sets) ^ ID_KERN_DISTANCE;
+    vcache_store (cache, hot, 42, ID_KERN_DISTANCE);
+    for (i = 2; i < 100; i++) {
+        assert (vcache_load (cache, hot, &m, ID_KERN_DISTANCE) && m == 42);
+        vcache_store (cache, (5 + i * cache->sets) ^ ID_KERN_DISTANCE, i,
+                      ID_KERN_DISTANCE);
+    }
+    assert (vcache_load (cache, hot, &m, ID_KERN_DISTANCE) && m == 42);
+
     //  Cleanup
     hstring_destroy (&h1);
     hstring_destroy (&h2);
+    vcache_destroy (&cache);
+
+    //  Values persist across caches with the same tag
+    char path[] = "/tmp/harry-vcache-XXXXXX";
+    int fd = mkstemp (path);
+    assert (fd >= 0);
+    close (fd);
+    config_setting_set_string (config_lookup (cfg, "measures.cache_file"), path);
+
+    cache = vcache_new (cfg);
+    vcache_persist (cache, cfg, 0x1234);
+    assert (cache->file);
+    for (i = 1; i <= 1000; i++)
+        vcache_store (cache, i * 0x9e3779b97f4a7c15ULL, i, ID_COMPARE);
+    vcache_destroy (&cache);
+
+    cache = vcache_new (cfg);
+    vcache_persist (cache, cfg, 0x1234);
+    for (i = 1, err = 0; i <= 1000; i++)
+        if (!vcache_load (cache, i * 0x9e3779b97f4a7c15ULL, &m, ID_COMPARE)
+            || m != i)
+            err++;
+    assert (err < 50);
+    assert (!vcache_load (cache, 0x9e3779b97f4a7c15ULL, &m, ID_NORM));
+
+    //  Values of other tags are not visible
+    vcache_invalidate (cache);
+    vcache_persist (cache, cfg, 0x5678);
+    assert (!vcache_load (cache, 0x9e3779b97f4a7c15ULL, &m, ID_COMPARE));
+    vcache_destroy (&cache);
+
+    //  Read-only caches load, but do not store values
+    config_setting_set_bool (config_lookup (cfg, "measures.cache_readonly"), TRUE);
+    cache = vcache_new (cfg);
+    vcache_persist (cache, cfg, 0x1234);
+    assert (cache->readonly);
+    assert (vcache_load (cache, 1000 * 0x9e3779b97f4a7c15ULL, &m, ID_COMPARE));
+    vcache_store (cache, 0x42, 1, ID_COMPARE);
+    vcache_invalidate (cache);
+    assert (!vcache_load (cache, 0x42, &m, ID_COMPARE));
+    vcache_destroy (&cache);
+    unlink (path);
+
     config_destroy (cfg);
     free (cfg);
-    vcache_destroy (&cache);
 
     // @end
     printf ("OK\n");
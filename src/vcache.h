@@ -18,14 +18,40 @@
 #define ID_NORM                 3       /* Normalization */
 #define ID_KERN_DISTANCE	4       /* Distance substitution kernel */
 #define ID_DIST_KERNEL		5       /* Kernel-based distance */
+#define ID_MAX                  8       /* Upper bound of task IDs */
+
+/** Maximum number of threads with separate statistics */
+#define VCACHE_THREADS          256
+/** Maximum number of entries per set */
+#define VCACHE_WAYS             8
 
 typedef struct
 {
-    uint64_t key;       /**< Hash for sequences */
+    uint32_t seq;       /**< Sequence counter (odd during updates) */
     int id;             /**< ID of task */
+    uint64_t key;       /**< Hash for sequences */
     float val;          /**< Cached similarity value */
+    uint8_t ref;        /**< Reference bit for CLOCK eviction */
 } entry_t;
 
+/** Magic bytes of a persistent cache file */
+#define VCACHE_MAGIC            "HARRYVC1"
+
+typedef struct
+{
+    char magic[8];      /**< Magic bytes */
+    uint32_t ways;      /**< Number of entries per set */
+    uint32_t pad;       /**< Padding */
+    uint64_t sets;      /**< Number of sets */
+} fheader_t;
+
+typedef struct
+{
+    uint32_t seq;       /**< Sequence counter (odd during updates) */
+    float val;          /**< Cached similarity value */
+    uint64_t key;       /**< Hash for sequences, task and tag */
+} fentry_t;
+
 vcache_t *
 vcache_new (config_t *cfg);
 void
@@ -34,9 +60,12 @@ void
 vcache_invalidate (vcache_t *self);
 int vcache_load (vcache_t *self, uint64_t key, float *value, int);
 int vcache_store (vcache_t *self, uint64_t key, float value, int);
+void vcache_persist (vcache_t *self, config_t *cfg, uint64_t tag);
 void vcache_info (vcache_t *self);
 float vcache_get_hitrate (vcache_t *self);
+float vcache_get_hitrate_id (vcache_t *self, int id);
 float vcache_get_used (vcache_t *self);
+int vcache_thread_slot (void);
 void vcache_test (bool verbose);
 
 #endif